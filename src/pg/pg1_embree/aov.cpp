@@ -0,0 +1,398 @@
+#include "stdafx.h"
+#include "aov.h"
+#include "imageio.h"
+#include "structs.h"
+#include "utils.h"
+#include <algorithm>
+
+AovRegistry::AovRegistry( const int width, const int height )
+{
+	width_ = width;
+	height_ = height;
+}
+
+AovHandle AovRegistry::Register( const std::string & name, const AovFormat format, const AovMode mode,
+	const bool enabled, const float clear_value, const bool required )
+{
+	Buffer buffer;
+	buffer.name = name;
+	buffer.format = format;
+	buffer.mode = mode;
+	buffer.requested = enabled || required;
+	buffer.required = required;
+	buffer.clear_value = clear_value;
+
+	buffers_.push_back( std::move( buffer ) );
+	if ( buffers_.back().requested )
+	{
+		Allocate( buffers_.back() );
+	}
+
+	AovHandle handle;
+	handle.index = static_cast<int>( buffers_.size() ) - 1;
+
+	return handle;
+}
+
+AovHandle AovRegistry::RegisterExternal( const std::string & name, const AovFormat format, void * data )
+{
+	Buffer buffer;
+	buffer.name = name;
+	buffer.format = format;
+	buffer.external = true;
+	buffer.requested = true;
+	buffer.data = data;
+
+	buffers_.push_back( std::move( buffer ) );
+
+	AovHandle handle;
+	handle.index = static_cast<int>( buffers_.size() ) - 1;
+
+	return handle;
+}
+
+AovHandle AovRegistry::Find( const std::string & name ) const
+{
+	AovHandle handle;
+
+	for ( int i = 0; i < static_cast<int>( buffers_.size() ); ++i )
+	{
+		if ( buffers_[i].name == name )
+		{
+			handle.index = i;
+			break;
+		}
+	}
+
+	return handle;
+}
+
+void AovRegistry::RequestEnabled( const AovHandle handle, const bool enabled )
+{
+	std::lock_guard<std::mutex> lock( requests_lock_ );
+
+	Buffer & buffer = buffers_[handle.index];
+	if ( !buffer.external && !buffer.required && buffer.requested != enabled )
+	{
+		buffer.requested = enabled;
+		requests_dirty_ = true;
+	}
+}
+
+bool AovRegistry::Apply()
+{
+	std::lock_guard<std::mutex> lock( requests_lock_ );
+
+	if ( !requests_dirty_ )
+	{
+		return false;
+	}
+	requests_dirty_ = false;
+
+	bool restart = false;
+	for ( Buffer & buffer : buffers_ )
+	{
+		if ( buffer.external || buffer.requested == ( buffer.data != nullptr ) )
+		{
+			continue;
+		}
+
+		if ( buffer.requested )
+		{
+			Allocate( buffer );
+			// an empty average cannot continue with the samples already in the accumulator
+			restart |= ( buffer.mode == AOV_AVERAGE );
+		}
+		else
+		{
+			std::vector<float>().swap( buffer.floats );
+			std::vector<unsigned int>().swap( buffer.uints );
+			std::vector<unsigned int>().swap( buffer.samples );
+			buffer.data = nullptr;
+		}
+	}
+
+	return restart;
+}
+
+void AovRegistry::Clear()
+{
+	for ( Buffer & buffer : buffers_ )
+	{
+		if ( !buffer.external && buffer.data != nullptr )
+		{
+			ClearBuffer( buffer );
+		}
+	}
+}
+
+void AovRegistry::Remap( const std::vector<int> & sources )
+{
+	for ( Buffer & buffer : buffers_ )
+	{
+		if ( buffer.external || buffer.data == nullptr )
+		{
+			continue;
+		}
+
+		const int n = channels( buffer );
+
+		if ( buffer.format == AOV_UINT )
+		{
+			const std::vector<unsigned int> previous = buffer.uints;
+			for ( int i = 0; i < width_ * height_; ++i )
+			{
+				buffer.uints[i] = ( sources[i] >= 0 ) ? previous[sources[i]] : 0xffffffff;
+			}
+		}
+		else
+		{
+			const std::vector<float> previous = buffer.floats;
+			for ( int i = 0; i < width_ * height_; ++i )
+			{
+				for ( int c = 0; c < n; ++c )
+				{
+					buffer.floats[i * n + c] = ( sources[i] >= 0 ) ? previous[sources[i] * n + c] : buffer.clear_value;
+				}
+			}
+		}
+
+		if ( buffer.mode == AOV_AVERAGE )
+		{
+			const std::vector<unsigned int> previous = buffer.samples;
+			for ( int i = 0; i < width_ * height_; ++i )
+			{
+				buffer.samples[i] = ( sources[i] >= 0 ) ? previous[sources[i]] : 0;
+			}
+		}
+	}
+}
+
+int AovRegistry::count() const
+{
+	return static_cast<int>( buffers_.size() );
+}
+
+const std::string & AovRegistry::name( const AovHandle handle ) const
+{
+	return buffers_[handle.index].name;
+}
+
+AovFormat AovRegistry::format( const AovHandle handle ) const
+{
+	return buffers_[handle.index].format;
+}
+
+bool AovRegistry::enabled( const AovHandle handle ) const
+{
+	return handle.index >= 0 && buffers_[handle.index].data != nullptr;
+}
+
+bool AovRegistry::requested( const AovHandle handle ) const
+{
+	std::lock_guard<std::mutex> lock( requests_lock_ );
+
+	return buffers_[handle.index].requested;
+}
+
+bool AovRegistry::required( const AovHandle handle ) const
+{
+	return buffers_[handle.index].required;
+}
+
+float * AovRegistry::floats( const AovHandle handle ) const
+{
+	return ( handle.index >= 0 && buffers_[handle.index].format != AOV_UINT ) ? static_cast<float *>( buffers_[handle.index].data ) : nullptr;
+}
+
+void AovRegistry::ToRGBA( const AovHandle handle, float * rgba, const bool visualize ) const
+{
+	const Buffer & buffer = buffers_[handle.index];
+	const int no_pixels = width_ * height_;
+
+	if ( buffer.data == nullptr )
+	{
+		memset( rgba, 0, no_pixels * 4 * sizeof( float ) );
+		return;
+	}
+
+	switch ( buffer.format )
+	{
+	case AOV_FLOAT4:
+		memcpy( rgba, buffer.data, no_pixels * 4 * sizeof( float ) );
+		break;
+
+	case AOV_FLOAT:
+	{
+		const float * data = static_cast<const float *>( buffer.data );
+
+		// FLT_MAX marks missing values (e.g. depth of the background)
+		float scale = 1.0f;
+		if ( visualize )
+		{
+			float max_value = 0.0f;
+			for ( int i = 0; i < no_pixels; ++i )
+			{
+				if ( data[i] < FLT_MAX )
+				{
+					max_value = max( max_value, data[i] );
+				}
+			}
+			scale = ( max_value > 0.0f ) ? 1.0f / max_value : 1.0f;
+		}
+
+		for ( int i = 0; i < no_pixels; ++i )
+		{
+			const float value = ( visualize && data[i] >= FLT_MAX ) ? 0.0f : data[i] * scale;
+			rgba[i * 4] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = value;
+			rgba[i * 4 + 3] = 1.0f;
+		}
+		break;
+	}
+
+	case AOV_UINT:
+	{
+		const unsigned int * data = static_cast<const unsigned int *>( buffer.data );
+
+		for ( int i = 0; i < no_pixels; ++i )
+		{
+			if ( !visualize )
+			{
+				const float value = ( data[i] == 0xffffffff ) ? -1.0f : static_cast<float>( data[i] );
+				rgba[i * 4] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = value;
+			}
+			else if ( data[i] == 0xffffffff )
+			{
+				rgba[i * 4] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = 0.0f;
+			}
+			else
+			{
+				// neighbouring IDs get unrelated colors
+				const unsigned int hash = HashSeed( data[i], 0 );
+				rgba[i * 4] = ( hash & 0xff ) / 255.0f;
+				rgba[i * 4 + 1] = ( ( hash >> 8 ) & 0xff ) / 255.0f;
+				rgba[i * 4 + 2] = ( ( hash >> 16 ) & 0xff ) / 255.0f;
+			}
+			rgba[i * 4 + 3] = 1.0f;
+		}
+		break;
+	}
+	}
+}
+
+float AovRegistry::ToHeatmap( const AovHandle handle, float * rgba ) const
+{
+	const float * data = floats( handle );
+	const int no_pixels = width_ * height_;
+
+	if ( data == nullptr || buffers_[handle.index].format != AOV_FLOAT )
+	{
+		memset( rgba, 0, no_pixels * 4 * sizeof( float ) );
+		return 0.0f;
+	}
+
+	std::vector<float> values;
+	values.reserve( no_pixels );
+	for ( int i = 0; i < no_pixels; ++i )
+	{
+		if ( data[i] < FLT_MAX )
+		{
+			values.push_back( data[i] );
+		}
+	}
+
+	float top = 0.0f;
+	if ( !values.empty() )
+	{
+		const size_t k = ( values.size() - 1 ) * 99 / 100;
+		std::nth_element( values.begin(), values.begin() + k, values.end() );
+		top = values[k];
+	}
+
+	const float ramp[6][3] = { { 0.0f, 0.0f, 0.0f }, { 0.1f, 0.1f, 0.8f }, { 0.1f, 0.7f, 0.8f },
+		{ 0.2f, 0.8f, 0.1f }, { 1.0f, 0.9f, 0.1f }, { 1.0f, 0.1f, 0.1f } };
+	const float inv_log_top = ( top > 0.0f ) ? 1.0f / log1pf( top ) : 0.0f;
+
+	for ( int i = 0; i < no_pixels; ++i )
+	{
+		const float t = ( data[i] < FLT_MAX ) ? min( 1.0f, log1pf( max( 0.0f, data[i] ) ) * inv_log_top ) * 5.0f : 0.0f;
+		const int j = min( 4, static_cast<int>( t ) );
+		const float k = t - j;
+
+		for ( int c = 0; c < 3; ++c )
+		{
+			rgba[i * 4 + c] = ramp[j][c] + ( ramp[j + 1][c] - ramp[j][c] ) * k;
+		}
+		rgba[i * 4 + 3] = 1.0f;
+	}
+
+	return top;
+}
+
+int AovRegistry::Save( const AovHandle handle, const std::string & file_name ) const
+{
+	std::vector<float> rgba( width_ * height_ * 4 );
+	ToRGBA( handle, rgba.data(), false );
+
+	return SaveImage( file_name, rgba.data(), width_, height_ );
+}
+
+void AovRegistry::SaveAll( const std::string & prefix, const std::string & extension ) const
+{
+	for ( int i = 0; i < static_cast<int>( buffers_.size() ); ++i )
+	{
+		if ( buffers_[i].data == nullptr )
+		{
+			continue;
+		}
+
+		AovHandle handle;
+		handle.index = i;
+
+		const std::string file_name = prefix + "_" + buffers_[i].name + "." + extension;
+		if ( Save( handle, file_name ) == 0 )
+		{
+			printf( "AOV %s saved to %s.\n", buffers_[i].name.c_str(), file_name.c_str() );
+		}
+	}
+}
+
+int AovRegistry::channels( const Buffer & buffer ) const
+{
+	return ( buffer.format == AOV_FLOAT4 ) ? 4 : 1;
+}
+
+void AovRegistry::Allocate( Buffer & buffer )
+{
+	if ( buffer.format == AOV_UINT )
+	{
+		buffer.uints.resize( width_ * height_ );
+		buffer.data = buffer.uints.data();
+	}
+	else
+	{
+		buffer.floats.resize( width_ * height_ * channels( buffer ) );
+		buffer.data = buffer.floats.data();
+	}
+
+	if ( buffer.mode == AOV_AVERAGE )
+	{
+		buffer.samples.resize( width_ * height_ );
+	}
+
+	ClearBuffer( buffer );
+}
+
+void AovRegistry::ClearBuffer( Buffer & buffer )
+{
+	if ( buffer.format == AOV_UINT )
+	{
+		std::fill( buffer.uints.begin(), buffer.uints.end(), 0xffffffff );
+	}
+	else
+	{
+		std::fill( buffer.floats.begin(), buffer.floats.end(), buffer.clear_value );
+	}
+
+	std::fill( buffer.samples.begin(), buffer.samples.end(), 0 );
+}
@@ -0,0 +1,163 @@
+#ifndef AOV_H_
+#define AOV_H_
+
+#include "vector3.h"
+
+/* layout of a single pixel of the AOV */
+enum AovFormat { AOV_FLOAT = 1, AOV_FLOAT4 = 2, AOV_UINT = 3 };
+
+/* how the samples of one pixel are combined */
+enum AovMode { AOV_LAST = 1, AOV_AVERAGE = 2 };
+
+/* index of the AOV in the registry, negative for no AOV */
+struct AovHandle
+{
+	int index{ -1 };
+};
+
+/*! \class AovRegistry
+\brief Named typed per-pixel buffers (arbitrary output variables) beside the beauty image.
+
+AOVs are registered once and then written by the shaders through their handles. A disabled
+AOV has no storage, its writes end with a single null pointer test, so unused AOVs cost
+nothing but that branch on the hot path. Enabling and disabling is requested from any thread
+and applied by the producer thread between passes.
+*/
+class AovRegistry
+{
+public:
+	AovRegistry() {};
+	AovRegistry( const int width, const int height );
+
+	AovRegistry( const AovRegistry & ) = delete;
+	AovRegistry & operator=( const AovRegistry & ) = delete;
+
+	/* new AOV owned by the registry, only safe before rendering starts, a required AOV is always enabled */
+	AovHandle Register( const std::string & name, const AovFormat format, const AovMode mode,
+		const bool enabled = false, const float clear_value = 0.0f, const bool required = false );
+	/* view of a buffer owned by the caller, it is always enabled and never cleared by the registry */
+	AovHandle RegisterExternal( const std::string & name, const AovFormat format, void * data );
+	/* handle of the AOV with the given name or an invalid one */
+	AovHandle Find( const std::string & name ) const;
+
+	/* thread safe request to allocate or release the buffer before the next pass, required AOVs ignore it */
+	void RequestEnabled( const AovHandle handle, const bool enabled );
+	/* applies the requests, returns true if an averaged AOV was enabled and so the accumulation has to restart */
+	bool Apply();
+
+	/* clears all owned buffers (IDs to 0xffffffff), averages restart with their next sample */
+	void Clear();
+	/* target pixel i takes the value of the pixel sources[i], or the cleared value if sources[i] < 0 */
+	void Remap( const std::vector<int> & sources );
+
+	int count() const;
+	const std::string & name( const AovHandle handle ) const;
+	AovFormat format( const AovHandle handle ) const;
+	/* true if the AOV has storage, may lag behind RequestEnabled until the next Apply */
+	bool enabled( const AovHandle handle ) const;
+	/* thread safe state including pending requests, for the user interface */
+	bool requested( const AovHandle handle ) const;
+	/* true if the renderer depends on the AOV, so it cannot be disabled */
+	bool required( const AovHandle handle ) const;
+	/* storage of a float (or float4) AOV, nullptr if disabled */
+	float * floats( const AovHandle handle ) const;
+
+	/*! \fn void ToRGBA( const AovHandle handle, float * rgba, const bool visualize ) const
+	\brief Converts the AOV into an RGBA float image.
+	\param visualize if true, IDs get distinct colors and scalars are scaled to <0, 1>, otherwise
+	scalars and IDs are stored as they are (IDs are exact up to 2^24).
+	*/
+	void ToRGBA( const AovHandle handle, float * rgba, const bool visualize ) const;
+	/*! \fn float ToHeatmap( const AovHandle handle, float * rgba ) const
+	\brief Maps the scalar AOV to colors from black over blue, green and yellow to red.
+	The ramp is logarithmic and saturates at the 99th percentile, so a few extreme pixels
+	do not hide the rest. Missing values (FLT_MAX) are black.
+	\return value mapped to the top of the ramp.
+	*/
+	float ToHeatmap( const AovHandle handle, float * rgba ) const;
+	/* writes the AOV as PFM or EXR, only safe between passes */
+	int Save( const AovHandle handle, const std::string & file_name ) const;
+	/* writes every enabled AOV into prefix_name.extension */
+	void SaveAll( const std::string & prefix, const std::string & extension ) const;
+
+	/* next sample of the pixel, the handle has to be valid, the write is ignored if the AOV is disabled,
+	averaged AOVs count the samples of every pixel themselves, so a cleared pixel restarts even if the beauty image does not */
+	inline void Write( const AovHandle handle, const int pixel, const float value );
+	inline void Write( const AovHandle handle, const int pixel, const Vector3 & value );
+	inline void Write( const AovHandle handle, const int pixel, const unsigned int value );
+
+private:
+	struct Buffer
+	{
+		std::string name;
+		AovFormat format{ AOV_FLOAT };
+		AovMode mode{ AOV_LAST };
+		bool external{ false };
+		bool required{ false }; // never released
+		bool requested{ false }; // guarded by requests_lock_
+		float clear_value{ 0.0f }; // of float AOVs
+		void * data{ nullptr }; // storage or the external buffer, nullptr if disabled
+		std::vector<float> floats; // storage of owned AOVs
+		std::vector<unsigned int> uints;
+		std::vector<unsigned int> samples; // per pixel, of averaged AOVs
+	};
+
+	int channels( const Buffer & buffer ) const;
+	void Allocate( Buffer & buffer );
+	void ClearBuffer( Buffer & buffer );
+
+	int width_{ 0 };
+	int height_{ 0 };
+	std::vector<Buffer> buffers_;
+	mutable std::mutex requests_lock_;
+	bool requests_dirty_{ false }; // guarded by requests_lock_
+};
+
+inline void AovRegistry::Write( const AovHandle handle, const int pixel, const float value )
+{
+	Buffer & buffer = buffers_[handle.index];
+	float * data = static_cast<float *>( buffer.data );
+	if ( data == nullptr )
+	{
+		return;
+	}
+
+	data[pixel] = ( buffer.mode == AOV_AVERAGE ) ? data[pixel] + ( value - data[pixel] ) / ++buffer.samples[pixel] : value;
+}
+
+inline void AovRegistry::Write( const AovHandle handle, const int pixel, const Vector3 & value )
+{
+	Buffer & buffer = buffers_[handle.index];
+	float * data = static_cast<float *>( buffer.data );
+	if ( data == nullptr )
+	{
+		return;
+	}
+
+	float * dst = data + pixel * 4;
+	if ( buffer.mode == AOV_AVERAGE )
+	{
+		const float k = 1.0f / ++buffer.samples[pixel];
+		dst[0] += ( value.x - dst[0] ) * k;
+		dst[1] += ( value.y - dst[1] ) * k;
+		dst[2] += ( value.z - dst[2] ) * k;
+	}
+	else
+	{
+		dst[0] = value.x;
+		dst[1] = value.y;
+		dst[2] = value.z;
+	}
+	dst[3] = 1.0f;
+}
+
+inline void AovRegistry::Write( const AovHandle handle, const int pixel, const unsigned int value )
+{
+	unsigned int * data = static_cast<unsigned int *>( buffers_[handle.index].data );
+	if ( data != nullptr )
+	{
+		data[pixel] = value;
+	}
+}
+
+#endif
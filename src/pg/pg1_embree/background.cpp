@@ -2,26 +2,288 @@
 #include "Background.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <algorithm>
 
+namespace
+{
+	inline float SignNotZero(const float x)
+	{
+		return (x >= 0.0f) ? 1.0f : -1.0f;
+	}
+
+	/* maps the normalized direction to the square <0, 1> x <0, 1> */
+	inline void DirectionToOctahedral(const float x, const float y, const float z, float & u, float & v)
+	{
+		const float inv_l1 = 1.0f / (fabsf(x) + fabsf(y) + fabsf(z));
+		float px = x * inv_l1;
+		float py = y * inv_l1;
+
+		// the lower hemisphere is folded over the diagonals
+		if (z < 0.0f)
+		{
+			const float tx = (1.0f - fabsf(py)) * SignNotZero(px);
+			py = (1.0f - fabsf(px)) * SignNotZero(py);
+			px = tx;
+		}
+
+		u = px * 0.5f + 0.5f;
+		v = py * 0.5f + 0.5f;
+	}
+
+	inline Vector3 OctahedralToDirection(const float u, const float v)
+	{
+		float px = 2.0f * u - 1.0f;
+		float py = 2.0f * v - 1.0f;
+		const float z = 1.0f - fabsf(px) - fabsf(py);
+
+		if (z < 0.0f)
+		{
+			const float tx = (1.0f - fabsf(py)) * SignNotZero(px);
+			py = (1.0f - fabsf(px)) * SignNotZero(py);
+			px = tx;
+		}
+
+		Vector3 dir(px, py, z);
+		dir.Normalize();
 
+		return dir;
+	}
 
-Background::Background(const char filename[])
+	inline void DirectionToLatLong(const float x, const float y, const float z, float & u, float & v)
+	{
+		const float theta = acosf(max(-1.0f, min(1.0f, z)));
+		const float phi = atan2f(y, x) + float(M_PI);
+
+		u = 1.0f - phi * 0.5f * float(M_1_PI);
+		v = theta * float(M_1_PI);
+	}
+
+	inline Vector3 LatLongToDirection(const float u, const float v)
+	{
+		const float theta = v * float(M_PI);
+		const float phi = (1.0f - u) * 2.0f * float(M_PI) - float(M_PI);
+		const float sin_theta = sinf(theta);
+
+		return Vector3(sin_theta * cosf(phi), sin_theta * sinf(phi), cosf(theta));
+	}
+
+	/* index i of the cdf interval <cdf[i], cdf[i + 1]) containing ksi, cdf has count + 1 values */
+	inline int FindInterval(const float * cdf, const int count, const float ksi)
+	{
+		return max(0, min(count - 1, static_cast<int>(std::upper_bound(cdf, cdf + count + 1, ksi) - cdf) - 1));
+	}
+}
+
+Background::Background(const char filename[], const Mapping mapping, const int resolution)
 {
-	texture = new Texture(filename);
+	mapping_ = mapping;
+
+	Texture texture(filename);
+	if (texture.width() == 0 || texture.height() == 0)
+	{
+		printf("Unable to load background %s.\n", filename);
+		return;
+	}
+
+	// 8-bit images are decoded from sRGB by the texture, HDR ones are linear already
+	printf("Background %s (%dx%d, %s).\n", filename, texture.width(), texture.height(), texture.is_hdr() ? "HDR" : "LDR");
+
+	if (mapping_ == LAT_LONG)
+	{
+		width_ = texture.width();
+		height_ = texture.height();
+		data_.resize(width_ * height_ * 3);
+
+		// u = x / width hits the texel exactly, so the copy is not blurred
+		for (int y = 0; y < height_; ++y)
+		{
+			for (int x = 0; x < width_; ++x)
+			{
+				const Color4f texel = texture.get_texel(float(x) / width_, float(y) / height_);
+				float * dst = &data_[(y * width_ + x) * 3];
+				dst[0] = texel.r;
+				dst[1] = texel.g;
+				dst[2] = texel.b;
+			}
+		}
+	}
+	else
+	{
+		width_ = height_ = (resolution > 0) ? resolution :
+			static_cast<int>(sqrtf(float(texture.width()) * texture.height()));
+		data_.resize(width_ * height_ * 3);
+
+		// all transcendental functions are evaluated once per texel here
+#pragma omp parallel for schedule(dynamic, 16)
+		for (int y = 0; y < height_; ++y)
+		{
+			for (int x = 0; x < width_; ++x)
+			{
+				const Vector3 dir = OctahedralToDirection((x + 0.5f) / width_, (y + 0.5f) / height_);
+				float u, v;
+				DirectionToLatLong(dir.x, dir.y, dir.z, u, v);
+
+				const Color4f texel = texture.get_texel(u, v);
+				float * dst = &data_[(y * width_ + x) * 3];
+				dst[0] = texel.r;
+				dst[1] = texel.g;
+				dst[2] = texel.b;
+			}
+		}
+	}
+
+	BuildDistribution();
 }
 
+void Background::BuildDistribution()
+{
+	cell_pdf_.assign(cdf_width_ * cdf_height_, 0.0f);
+	conditional_cdf_.assign((cdf_width_ + 1) * cdf_height_, 0.0f);
+	marginal_cdf_.assign(cdf_height_ + 1, 0.0f);
+
+	for (int j = 0; j < cdf_height_; ++j)
+	{
+		const float v = (j + 0.5f) / cdf_height_;
+		const float sin_theta = sinf(v * float(M_PI));
+		float * cdf = &conditional_cdf_[j * (cdf_width_ + 1)];
+
+		for (int i = 0; i < cdf_width_; ++i)
+		{
+			const Vector3 dir = LatLongToDirection((i + 0.5f) / cdf_width_, v);
+			const Color4f radiance = GetBackground(dir.x, dir.y, dir.z);
+			const float luminance = 0.2126f * radiance.r + 0.7152f * radiance.g + 0.0722f * radiance.b;
+
+			cell_pdf_[j * cdf_width_ + i] = luminance * sin_theta;
+			cdf[i + 1] = cdf[i] + cell_pdf_[j * cdf_width_ + i];
+		}
+
+		marginal_cdf_[j + 1] = marginal_cdf_[j] + cdf[cdf_width_];
 
+		// normalized conditional cdf of the row
+		if (cdf[cdf_width_] > 0.0f)
+		{
+			const float inv_sum = 1.0f / cdf[cdf_width_];
+			for (int i = 1; i <= cdf_width_; ++i)
+			{
+				cdf[i] *= inv_sum;
+			}
+		}
+	}
 
-Color4f Background::GetBackground(const float x, const float y, const float z) {
-	const float theta = acosf(z);
-	const float phi = atan2f(y, x) + float(M_PI);
+	const float sum = marginal_cdf_[cdf_height_];
+	if (sum <= 0.0f)
+	{
+		cell_pdf_.clear(); // black map, nothing to sample
+		return;
+	}
 
-	const float u = 1.0f - phi * 0.5f * float(M_1_PI);
-	const float v = theta  * float(M_1_PI);
+	for (int j = 1; j <= cdf_height_; ++j)
+	{
+		marginal_cdf_[j] /= sum;
+	}
 
-	return  texture->get_texel(u, v);
+	// the mean of the cell values has to be 1 over the unit square
+	const float scale = (cdf_width_ * cdf_height_) / sum;
+	for (float & pdf : cell_pdf_)
+	{
+		pdf *= scale;
+	}
 }
 
+Vector3 Background::Sample(const float u1, const float u2, float & pdf) const
+{
+	if (cell_pdf_.empty())
+	{
+		pdf = 0.0f;
+		return Vector3(0.0f, 0.0f, 1.0f);
+	}
+
+	const int j = FindInterval(marginal_cdf_.data(), cdf_height_, u2);
+	const float * cdf = &conditional_cdf_[j * (cdf_width_ + 1)];
+	const int i = FindInterval(cdf, cdf_width_, u1);
+
+	// continuous position inside the selected cell
+	const float dv = (marginal_cdf_[j + 1] > marginal_cdf_[j]) ? (u2 - marginal_cdf_[j]) / (marginal_cdf_[j + 1] - marginal_cdf_[j]) : 0.5f;
+	const float du = (cdf[i + 1] > cdf[i]) ? (u1 - cdf[i]) / (cdf[i + 1] - cdf[i]) : 0.5f;
+	const float u = (i + du) / cdf_width_;
+	const float v = (j + dv) / cdf_height_;
+
+	const float sin_theta = sinf(v * float(M_PI));
+	pdf = (sin_theta > 0.0f) ? cell_pdf_[j * cdf_width_ + i] / (2.0f * float(M_PI) * float(M_PI) * sin_theta) : 0.0f;
+
+	return LatLongToDirection(u, v);
+}
+
+float Background::Pdf(const Vector3 & dir) const
+{
+	if (cell_pdf_.empty())
+	{
+		return 0.0f;
+	}
+
+	float u, v;
+	DirectionToLatLong(dir.x, dir.y, dir.z, u, v);
+
+	const int i = max(0, min(cdf_width_ - 1, static_cast<int>(u * cdf_width_)));
+	const int j = max(0, min(cdf_height_ - 1, static_cast<int>(v * cdf_height_)));
+	const float sin_theta = sqrtf(max(0.0f, 1.0f - dir.z * dir.z));
+
+	return (sin_theta > 0.0f) ? cell_pdf_[j * cdf_width_ + i] / (2.0f * float(M_PI) * float(M_PI) * sin_theta) : 0.0f;
+}
+
+Color4f Background::GetBackground(const float x, const float y, const float z) const
+{
+	if (data_.empty())
+	{
+		return Color4f(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	float u, v;
+	if (mapping_ == OCTAHEDRAL)
+	{
+		DirectionToOctahedral(x, y, z, u, v);
+
+		// texel centers are at (i + 0.5) / resolution
+		return Lookup(u * width_ - 0.5f, v * height_ - 0.5f);
+	}
+
+	DirectionToLatLong(x, y, z, u, v);
+
+	return Lookup(u * width_, v * height_);
+}
+
+Background::Mapping Background::mapping() const
+{
+	return mapping_;
+}
+
+Color4f Background::Lookup(const float x, const float y) const
+{
+	const float xc = max(0.0f, min(float(width_ - 1), x));
+	const float yc = max(0.0f, min(float(height_ - 1), y));
+
+	const int x0 = static_cast<int>(xc);
+	const int y0 = static_cast<int>(yc);
+	const int x1 = min(width_ - 1, x0 + 1);
+	const int y1 = min(height_ - 1, y0 + 1);
+
+	const float kx = xc - x0;
+	const float ky = yc - y0;
+
+	const float * p00 = &data_[(y0 * width_ + x0) * 3];
+	const float * p10 = &data_[(y0 * width_ + x1) * 3];
+	const float * p01 = &data_[(y1 * width_ + x0) * 3];
+	const float * p11 = &data_[(y1 * width_ + x1) * 3];
+
+	const float w00 = (1.0f - kx) * (1.0f - ky);
+	const float w10 = kx * (1.0f - ky);
+	const float w01 = (1.0f - kx) * ky;
+	const float w11 = kx * ky;
+
+	return Color4f(p00[0] * w00 + p10[0] * w10 + p01[0] * w01 + p11[0] * w11,
+		p00[1] * w00 + p10[1] * w10 + p01[1] * w01 + p11[1] * w11,
+		p00[2] * w00 + p10[2] * w10 + p01[2] * w01 + p11[2] * w11, 1.0f);
+}
 
 Background::~Background()
 {
@@ -1,14 +1,48 @@
 #pragma once
 #include "texture.h"
+
+/*! \class Background
+\brief Environment map converted to linear float RGB when loaded.
+
+The octahedral mapping folds the sphere of directions onto a square, so a lookup
+needs only a few abs and one division instead of acosf and atan2f of the
+latitude-longitude mapping of the source image.
+*/
 class Background
 {
 public:
-	Background() : texture(texture) {};
-	Background(const char filename[]) ;
-	Color4f GetBackground(const float x, const float y, const float z);
+	enum Mapping { LAT_LONG, OCTAHEDRAL };
+
+	Background() {};
+	/* resolution of the octahedral map, 0 keeps the number of texels of the source image */
+	Background(const char filename[], const Mapping mapping = OCTAHEDRAL, const int resolution = 0);
 	~Background();
+
+	/* linear radiance in the direction (x, y, z), the direction has to be normalized */
+	Color4f GetBackground(const float x, const float y, const float z) const;
+
+	/* direction drawn proportionally to the luminance, pdf is with respect to the solid angle (0 for an empty map) */
+	Vector3 Sample(const float u1, const float u2, float & pdf) const;
+	/* solid angle pdf of Sample generating the direction dir */
+	float Pdf(const Vector3 & dir) const;
+
+	Mapping mapping() const;
+
 private:
-	Texture *texture;
-};
+	/* bilinear interpolation of data_, (x, y) are continuous texel coordinates */
+	Color4f Lookup(const float x, const float y) const;
 
+	/* piecewise constant distribution over the lat-long parametrization, each cell weighted by sin(theta) */
+	void BuildDistribution();
 
+	Mapping mapping_{ OCTAHEDRAL };
+	int width_{ 0 };
+	int height_{ 0 };
+	std::vector<float> data_; // linear RGB, row-major
+
+	int cdf_width_{ 256 }; // resolution of the sampling distribution in phi
+	int cdf_height_{ 128 }; // and in theta
+	std::vector<float> cell_pdf_; // pdf of each cell over the unit square (u, v)
+	std::vector<float> conditional_cdf_; // cdf_width_ + 1 values per row
+	std::vector<float> marginal_cdf_; // cdf_height_ + 1 values
+};
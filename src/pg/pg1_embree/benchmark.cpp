@@ -0,0 +1,189 @@
+#include "stdafx.h"
+#include "benchmark.h"
+#include "raytracer.h"
+#include "imageio.h"
+#include "mymath.h"
+#include "utils.h"
+#include <psapi.h>
+
+#pragma comment( lib, "psapi.lib" )
+
+namespace
+{
+	struct BenchmarkScene
+	{
+		const char * name;
+		const char * file_name; // OBJ or SCN file
+		float fov_y; // deg
+		Vector3 view_from;
+		Vector3 view_at;
+		SceneProfile profile;
+	};
+
+	/* highest private bytes committed by the process so far */
+	size_t PeakMemory()
+	{
+		PROCESS_MEMORY_COUNTERS counters;
+		ZeroMemory( &counters, sizeof( counters ) );
+		GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) );
+
+		return counters.PeakPagefileUsage;
+	}
+
+	bool FileExists( const char * file_name )
+	{
+		FILE * file = fopen( file_name, "rb" );
+		if ( file != NULL )
+		{
+			fclose( file );
+			return true;
+		}
+
+		return false;
+	}
+
+	bool EndsWith( const std::string & s, const std::string & suffix )
+	{
+		return ( s.size() >= suffix.size() ) && ( s.compare( s.size() - suffix.size(), suffix.size(), suffix ) == 0 );
+	}
+
+	void LoadBenchmarkScene( Raytracer & raytracer, const BenchmarkScene & scene )
+	{
+		if ( EndsWith( scene.file_name, ".scn" ) )
+		{
+			raytracer.LoadSceneDescription( scene.file_name );
+		}
+		else
+		{
+			raytracer.LoadScene( scene.file_name );
+		}
+	}
+}
+
+int benchmark( const std::string & output_file, const BenchmarkSettings & settings, const char * config )
+{
+	const BenchmarkScene scenes[] = {
+		{ "cornell_box", "../../../data/cornell_box2.obj", 40.0f, Vector3( 40, -940, 250 ), Vector3( 0, 0, 250 ), SceneProfile::Final() },
+		{ "geosphere", "../../../data/geosphere.obj", 45.0f, Vector3( 3, 0, 0 ), Vector3( 0, 0, 0 ), SceneProfile() },
+		{ "geospheres", "../../../data/geospheres.scn", 45.0f, Vector3( 12, -12, 8 ), Vector3( 0, 0, 0 ), SceneProfile() },
+		{ "allied_avenger", "../../../data/6887_allied_avenger.obj", 50.0f, Vector3( 175, -140, 130 ), Vector3( 0, 0, 35 ), SceneProfile::Preview() },
+	};
+
+	FILE * file = fopen( output_file.c_str(), "wt" );
+	if ( file == NULL )
+	{
+		printf( "Unable to write %s.\n", output_file.c_str() );
+
+		return -1;
+	}
+
+	fprintf( file, "{\n\t\"settings\": {\"width\": %d, \"height\": %d, \"spp\": %d, \"seed\": %u, \"target_rmse\": %g},\n\t\"scenes\": [",
+		settings.width, settings.height, settings.spp, settings.seed, settings.target_rmse );
+
+	int failures = 0;
+	bool first = true;
+
+	for ( const BenchmarkScene & scene : scenes )
+	{
+		if ( !settings.scene.empty() && settings.scene != scene.name )
+		{
+			continue;
+		}
+
+		fprintf( file, "%s\n\t\t{\"name\": \"%s\", ", ( first ) ? "" : ",", scene.name );
+		first = false;
+
+		if ( !FileExists( scene.file_name ) )
+		{
+			printf( "Benchmark scene %s is missing (%s).\n", scene.name, scene.file_name );
+			fprintf( file, "\"error\": \"missing %s\"}", scene.file_name );
+			++failures;
+			continue;
+		}
+
+		printf( "Benchmarking %s...\n", scene.name );
+
+		Raytracer raytracer( settings.width, settings.height, deg2rad( scene.fov_y ),
+			scene.view_from, scene.view_at, config, scene.profile );
+		raytracer.SetSeed( settings.seed );
+		LoadBenchmarkScene( raytracer, scene );
+
+		const std::string reference_file = settings.reference_path + scene.name + ".pfm";
+		std::vector<float> reference;
+		int reference_width = 0;
+		int reference_height = 0;
+		const bool has_reference = ( LoadPFM( reference_file, reference, reference_width, reference_height ) == 0 ) &&
+			( reference_width == settings.width ) && ( reference_height == settings.height );
+
+		double render_time = 0.0;
+		unsigned long long rays = 0;
+		double time_to_target = -1.0;
+		int spp_to_target = -1;
+		double rmse = -1.0;
+
+		for ( int pass = 0; pass < settings.spp; ++pass )
+		{
+			raytracer.RenderPass();
+
+			const PassStats stats = raytracer.last_stats();
+			render_time += stats.pass_time;
+			rays += stats.totals.total_rays();
+
+			// RMSE evaluation is not included in the render time
+			if ( has_reference )
+			{
+				rmse = RMSE( raytracer.image(), reference.data(), settings.width, settings.height );
+				if ( spp_to_target < 0 && rmse <= settings.target_rmse )
+				{
+					time_to_target = render_time;
+					spp_to_target = pass + 1;
+				}
+			}
+		}
+
+		// taken before the reference renderer adds its own allocations
+		const size_t peak_memory = PeakMemory();
+
+		if ( !has_reference )
+		{
+			// a fresh renderer with another seed, a continuation of the benchmarked render would contain
+			// its samples and so make the measured error look smaller than it is
+			Raytracer reference_raytracer( settings.width, settings.height, deg2rad( scene.fov_y ),
+				scene.view_from, scene.view_at, config, scene.profile );
+			reference_raytracer.SetSeed( HashSeed( settings.seed, 0x7265f ) );
+			LoadBenchmarkScene( reference_raytracer, scene );
+
+			for ( int pass = 0; pass < settings.reference_spp; ++pass )
+			{
+				reference_raytracer.RenderPass();
+			}
+
+			CreateDirectoryA( settings.reference_path.c_str(), NULL );
+			SavePFM( reference_file, reference_raytracer.image(), settings.width, settings.height );
+			printf( "Reference image %s created.\n", reference_file.c_str() );
+		}
+
+		const double mrays = ( render_time > 0.0 ) ? rays / ( render_time * 1e+6 ) : 0.0;
+
+		fprintf( file, "\"load_time\": %g, \"build_time\": %g, \"render_time\": %g, \"rays\": %I64u, \"mrays_per_second\": %g, "
+			"\"rmse\": %g, \"time_to_target\": %g, \"spp_to_target\": %d, \"reference_created\": %s, \"peak_memory\": %I64u}",
+			raytracer.load_time(), raytracer.build_time(), render_time, rays, mrays,
+			rmse, time_to_target, spp_to_target, ( has_reference ) ? "false" : "true", static_cast<unsigned long long>( peak_memory ) );
+
+		printf( "%s: %.2f Mrays/s, RMSE %g, render took %s.\n\n", scene.name, mrays, rmse, TimeToString( render_time ).c_str() );
+	}
+
+	if ( first )
+	{
+		printf( "Benchmark scene %s does not exist.\n", settings.scene.c_str() );
+		++failures;
+	}
+
+	fprintf( file, "\n\t]\n}\n" );
+	fclose( file );
+	file = NULL;
+
+	printf( "Benchmark results written to %s.\n", output_file.c_str() );
+
+	return ( failures == 0 ) ? 0 : -1;
+}
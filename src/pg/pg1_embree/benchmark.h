@@ -0,0 +1,39 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+/*! \struct BenchmarkSettings
+\brief Fixed parameters shared by all benchmark scenes, runs with equal settings are comparable.
+*/
+struct BenchmarkSettings
+{
+	int width{ 320 };
+	int height{ 240 };
+	int spp{ 64 }; // number of passes, each adds one sample per pixel
+	unsigned int seed{ 1 };
+	double target_rmse{ 0.02 }; // RMSE against the reference which counts as converged
+	int reference_spp{ 1024 }; // samples per pixel of a newly created reference image
+	std::string reference_path{ "../../../data/benchmark/" }; // directory with <scene>.pfm reference images
+	std::string scene; // name of the only scene to render, all of them if empty
+};
+
+/*! \fn int benchmark( const std::string & output_file, const BenchmarkSettings & settings, const char * config )
+\brief Renders all bundled scenes headless and writes the measurements as JSON.
+
+For every scene it records OBJ load time, BVH build time, Mrays/s, the time (and spp)
+needed to get below the target RMSE and the peak private bytes of the process, which
+include transient allocations like the BVH build. The peak never falls, so it belongs to
+a single scene only if that scene is rendered alone (see BenchmarkSettings::scene, one
+process per scene) or first. A missing reference image is
+rendered with reference_spp samples of an independent seed and saved, so the first run
+on a new machine only records the references.
+
+The Cornell box has to be unpacked from data/cornell_box2.zip first, scenes with
+missing OBJ files are reported with an error and skipped.
+
+\param output_file full path to the JSON file.
+\return 0 if all scenes were rendered.
+*/
+int benchmark( const std::string & output_file = "benchmark.json", const BenchmarkSettings & settings = BenchmarkSettings(),
+	const char * config = "threads=0,verbose=0" );
+
+#endif
@@ -1,5 +1,7 @@
 #include "stdafx.h"
 #include "camera.h"
+#include "structs.h"
+#include "utils.h"
 
 Camera::Camera( const int width, const int height, const float fov_y,
 	const Vector3 view_from, const Vector3 view_at )
@@ -10,7 +12,13 @@ Camera::Camera( const int width, const int height, const float fov_y,
 
 	view_from_ = view_from;
 	view_at_ = view_at;
+	focal_distance_ = ( view_at_ - view_from_ ).L2Norm();
 
+	Update();
+}
+
+void Camera::Update()
+{
 	// compute focal lenght based on the vertical field of view and the camera resolution
 	f_y_ = height_ / (2.0f * tanf(fov_y_ *0.5f ));
 
@@ -34,15 +42,25 @@ RTCRay Camera::GenerateRay( const float x_i, const float y_i ) const
 	ray.org_z = view_from_.z;
 	ray.tnear = FLT_MIN; // start of ray segment
 
-	Vector3 d_c = Vector3(x_i - (width_ * 0.5f), (height_ * 0.5f) - y_i, - f_y_);
-	d_c.Normalize();
-	Vector3 dir = M_c_w_ * d_c;
-	dir.Normalize();
+	Vector3 dir = Direction( x_i, y_i );
+
+	if ( aperture_ > 0.0f )
+	{
+		// aim at the point of the focal plane the pin-hole ray passes through
+		const Vector3 lens = SampleLens();
+		const Vector3 z_c = M_c_w_ * Vector3( 0.0f, 0.0f, 1.0f );
+		dir = dir * ( focal_distance_ / -dir.DotProduct( z_c ) ) - lens;
+		dir.Normalize();
+
+		ray.org_x += lens.x;
+		ray.org_y += lens.y;
+		ray.org_z += lens.z;
+	}
 
 	ray.dir_x = dir.x; // ray direction
 	ray.dir_y = dir.y;
 	ray.dir_z = dir.z;
-	ray.time = 0.0f; // time of this ray for motion blur
+	ray.time = SampleTime(); // time of this ray for motion blur
 
 	ray.tfar = FLT_MAX; // end of ray segment (set to hit distance)
 
@@ -51,7 +69,224 @@ RTCRay Camera::GenerateRay( const float x_i, const float y_i ) const
 	ray.flags = 0; // reserved
 
 	// TODO fill in ray structure and compute ray direction
-	// ray.org_x = ...	
-	
+	// ray.org_x = ...
+
 	return ray;
 }
+
+void Camera::GenerateRays( const int x0, const int y, const int count, CameraRays & rays ) const
+{
+	rays.x0 = x0;
+	rays.y = y;
+	rays.count = count;
+
+	// WS direction to the top-left corner of the first pixel and its per-pixel steps,
+	// the CS depth of all these directions is -f_y_
+	const Vector3 step_x = M_c_w_ * Vector3( 1.0f, 0.0f, 0.0f );
+	const Vector3 step_y = M_c_w_ * Vector3( 0.0f, -1.0f, 0.0f );
+	Vector3 corner = M_c_w_ * Vector3( x0 - ( width_ * 0.5f ), ( height_ * 0.5f ) - y, -f_y_ );
+	const float focus_scale = focal_distance_ / f_y_;
+
+	for ( int i = 0; i < count; ++i, corner += step_x )
+	{
+		const float jitter_x = Random();
+		const float jitter_y = Random();
+		Vector3 dir = corner + jitter_x * step_x + jitter_y * step_y;
+		Vector3 org = view_from_;
+
+		if ( aperture_ > 0.0f )
+		{
+			const Vector3 lens = SampleLens();
+			dir = dir * focus_scale - lens;
+			org += lens;
+		}
+
+		const float inv_length = 1.0f / sqrtf( dir.SqrL2Norm() );
+		rays.time[i] = SampleTime();
+
+		rays.org_x[i] = org.x;
+		rays.org_y[i] = org.y;
+		rays.org_z[i] = org.z;
+		rays.dir_x[i] = dir.x * inv_length;
+		rays.dir_y[i] = dir.y * inv_length;
+		rays.dir_z[i] = dir.z * inv_length;
+	}
+}
+
+Vector3 Camera::SampleLens() const
+{
+	// uniform on the disk
+	const float r = aperture_ * sqrtf( Random() );
+	const float phi = 2.0f * float( M_PI ) * Random();
+
+	return M_c_w_ * Vector3( r * cosf( phi ), r * sinf( phi ), 0.0f );
+}
+
+float Camera::SampleTime() const
+{
+	// a closed shutter does not consume random numbers
+	return ( shutter_close_ > shutter_open_ ) ? shutter_open_ + ( shutter_close_ - shutter_open_ ) * Random() : shutter_open_;
+}
+
+RTCRay CameraRays::ray( const int i ) const
+{
+	RTCRay ray = RTCRay();
+
+	ray.org_x = org_x[i];
+	ray.org_y = org_y[i];
+	ray.org_z = org_z[i];
+	ray.tnear = FLT_MIN;
+
+	ray.dir_x = dir_x[i];
+	ray.dir_y = dir_y[i];
+	ray.dir_z = dir_z[i];
+	ray.time = time[i];
+
+	ray.tfar = FLT_MAX;
+
+	ray.mask = 0;
+	ray.id = 0;
+	ray.flags = 0;
+
+	return ray;
+}
+
+Vector3 Camera::Direction( const float x_i, const float y_i ) const
+{
+	Vector3 d_c = Vector3(x_i - (width_ * 0.5f), (height_ * 0.5f) - y_i, - f_y_);
+	d_c.Normalize();
+	Vector3 dir = M_c_w_ * d_c;
+	dir.Normalize();
+
+	return dir;
+}
+
+bool Camera::Project( const Vector3 & p, float & x_i, float & y_i ) const
+{
+	// M_c_w_ is orthonormal, its transpose maps WS -> CS
+	const Vector3 d_c = M_c_w_.Transpose() * ( p - view_from_ );
+
+	if ( d_c.z >= 0.0f )
+	{
+		return false;
+	}
+
+	x_i = ( width_ * 0.5f ) + f_y_ * d_c.x / -d_c.z;
+	y_i = ( height_ * 0.5f ) - f_y_ * d_c.y / -d_c.z;
+
+	return true;
+}
+
+void Camera::SetView( const Vector3 & view_from, const Vector3 & view_at )
+{
+	view_from_ = view_from;
+	view_at_ = view_at;
+
+	Update();
+}
+
+void Camera::MoveForward( const float step )
+{
+	Vector3 forward = view_at_ - view_from_;
+	forward.Normalize();
+
+	view_from_ += step * forward;
+	view_at_ += step * forward;
+
+	Update();
+}
+
+void Camera::MoveRight( const float step )
+{
+	const Vector3 right = M_c_w_ * Vector3( 1.0f, 0.0f, 0.0f );
+
+	view_from_ += step * right;
+	view_at_ += step * right;
+
+	Update();
+}
+
+void Camera::RotateRight( const float angle )
+{
+	const Vector3 forward = view_at_ - view_from_;
+	const Vector3 right = M_c_w_ * Vector3( 1.0f, 0.0f, 0.0f );
+	const float distance = forward.L2Norm();
+
+	const Vector3 dir = cosf( angle ) * ( forward / distance ) + sinf( angle ) * right;
+	view_at_ = view_from_ + distance * dir;
+
+	Update();
+}
+
+void Camera::RotateUp( const float angle )
+{
+	const Vector3 forward = view_at_ - view_from_;
+	const Vector3 up = M_c_w_ * Vector3( 0.0f, 1.0f, 0.0f );
+	const float distance = forward.L2Norm();
+
+	const Vector3 dir = cosf( angle ) * ( forward / distance ) + sinf( angle ) * up;
+
+	// keep away from the degenerate view parallel to the up vector
+	if ( fabsf( dir.DotProduct( up_ ) ) < 0.99f )
+	{
+		view_at_ = view_from_ + distance * dir;
+
+		Update();
+	}
+}
+
+void Camera::SetThinLens( const float aperture, const float focal_distance )
+{
+	aperture_ = max( 0.0f, aperture );
+	focal_distance_ = max( 1e-3f, focal_distance );
+}
+
+void Camera::SetShutter( const float open, const float close )
+{
+	shutter_open_ = max( 0.0f, min( 1.0f, open ) );
+	shutter_close_ = max( shutter_open_, min( 1.0f, close ) );
+}
+
+bool Camera::SameView( const Camera & camera ) const
+{
+	return ( width_ == camera.width_ ) && ( height_ == camera.height_ ) && ( fov_y_ == camera.fov_y_ ) &&
+		( view_from_.x == camera.view_from_.x ) && ( view_from_.y == camera.view_from_.y ) && ( view_from_.z == camera.view_from_.z ) &&
+		( view_at_.x == camera.view_at_.x ) && ( view_at_.y == camera.view_at_.y ) && ( view_at_.z == camera.view_at_.z ) &&
+		SameOptics( camera );
+}
+
+bool Camera::SameOptics( const Camera & camera ) const
+{
+	return ( aperture_ == camera.aperture_ ) && ( focal_distance_ == camera.focal_distance_ ) &&
+		( shutter_open_ == camera.shutter_open_ ) && ( shutter_close_ == camera.shutter_close_ );
+}
+
+float Camera::aperture() const
+{
+	return aperture_;
+}
+
+float Camera::focal_distance() const
+{
+	return focal_distance_;
+}
+
+float Camera::shutter_open() const
+{
+	return shutter_open_;
+}
+
+float Camera::shutter_close() const
+{
+	return shutter_close_;
+}
+
+Vector3 Camera::view_from() const
+{
+	return view_from_;
+}
+
+Vector3 Camera::view_at() const
+{
+	return view_at_;
+}
@@ -4,8 +4,36 @@
 #include "vector3.h"
 #include "matrix3x3.h"
 
+/*! \struct CameraRays
+\brief Primary rays of up to SIZE consecutive pixels of one image row in SoA layout.
+*/
+struct CameraRays
+{
+	static const int SIZE = 16;
+
+	int x0{ -1 }; // first pixel of the span
+	int y{ -1 }; // image row
+	int count{ 0 };
+
+	RTC_ALIGN( 16 ) float org_x[SIZE];
+	RTC_ALIGN( 16 ) float org_y[SIZE];
+	RTC_ALIGN( 16 ) float org_z[SIZE];
+	RTC_ALIGN( 16 ) float dir_x[SIZE]; // normalized
+	RTC_ALIGN( 16 ) float dir_y[SIZE];
+	RTC_ALIGN( 16 ) float dir_z[SIZE];
+	RTC_ALIGN( 16 ) float time[SIZE]; // within the shutter interval
+
+	/* the i-th ray of the span */
+	RTCRay ray( const int i ) const;
+};
+
 /*! \class Camera
-\brief A simple pin-hole camera.
+\brief A simple pin-hole camera with an optional thin lens and shutter.
+
+With a non-zero aperture the rays start on a disk of that radius around the eye and
+converge at the focal plane, which gives depth of field. With an open shutter the ray
+times are spread uniformly over the shutter interval, which gives motion blur of the
+moving geometry. Lens and time samples are drawn by Random().
 
 \author Tom Fabin
 \version 1.0
@@ -22,7 +50,55 @@ public:
 	/* generate primary ray, top-left pixel image coordinates (xi, yi) are in the range <0, 1) x <0, 1) */
 	RTCRay GenerateRay( const float xi, const float yi ) const;
 
+	/*! \fn void GenerateRays( const int x0, const int y, const int count, CameraRays & rays ) const
+	\brief Generates jittered primary rays of the pixels x0 .. x0 + count - 1 of the row y.
+	The unnormalized direction is stepped by one pixel along the row, so each ray costs
+	a single normalization instead of the matrix product and two normalizations of
+	GenerateRay. The jitter (and lens) samples are drawn by Random() pixel by pixel.
+	*/
+	void GenerateRays( const int x0, const int y, const int count, CameraRays & rays ) const;
+
+	/* normalized world space direction of the primary ray passing through the image point (xi, yi) */
+	Vector3 Direction( const float xi, const float yi ) const;
+
+	/* projects the world space point p to the image point (xi, yi), returns false for points behind the camera */
+	bool Project( const Vector3 & p, float & xi, float & yi ) const;
+
+	/* places the eye at view_from looking at view_at */
+	void SetView( const Vector3 & view_from, const Vector3 & view_at );
+
+	/* moves the camera along its viewing direction or sideways, step is in world units */
+	void MoveForward( const float step );
+	void MoveRight( const float step );
+
+	/* rotates the viewing direction around the eye, angles are in radians */
+	void RotateRight( const float angle );
+	void RotateUp( const float angle );
+
+	/* aperture is the lens radius and focal distance the distance of the sharp plane, both in world units, 0 aperture is a pin-hole */
+	void SetThinLens( const float aperture, const float focal_distance );
+	/* shutter interval within the frame <0, 1>, the ray time of a closed shutter (open == close) is open */
+	void SetShutter( const float open, const float close );
+
+	bool SameView( const Camera & camera ) const;
+	/* same lens and shutter */
+	bool SameOptics( const Camera & camera ) const;
+
+	float aperture() const;
+	float focal_distance() const;
+	float shutter_open() const;
+	float shutter_close() const;
+
+	Vector3 view_from() const;
+	Vector3 view_at() const;
+
 private:
+	/* recomputes the focal length and M_c_w_ from the current view */
+	void Update();
+	/* offset of a random point on the lens from the eye (WS) */
+	Vector3 SampleLens() const;
+	float SampleTime() const;
+
 	int width_{ 640 }; // image width (px)
 	int height_{ 480 };  // image height (px)
 	float fov_y_{ 0.785f }; // vertical field of view (rad)
@@ -33,6 +109,12 @@ private:
 
 	float f_y_{ 1.0f }; // focal lenght (px)
 
+	float aperture_{ 0.0f }; // lens radius (world units)
+	float focal_distance_{ 1.0f }; // distance of the plane in focus along the view axis (world units)
+
+	float shutter_open_{ 0.0f }; // ray times are in <shutter_open_, shutter_close_>
+	float shutter_close_{ 0.0f };
+
 	Matrix3x3 M_c_w_; // transformation matrix from CS -> WS	
 };
 
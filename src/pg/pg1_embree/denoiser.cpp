@@ -0,0 +1,118 @@
+#include "stdafx.h"
+#include "denoiser.h"
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+namespace
+{
+	/* sum of the squares of all four components */
+	inline float SquaredLength( const __m128 v )
+	{
+		__m128 s = _mm_mul_ps( v, v );
+		s = _mm_add_ps( s, _mm_movehl_ps( s, s ) );
+		s = _mm_add_ss( s, _mm_shuffle_ps( s, s, 1 ) );
+
+		return _mm_cvtss_f32( s );
+	}
+}
+
+Denoiser::Denoiser( const int width, const int height )
+{
+	width_ = width;
+	height_ = height;
+
+	levels_[0].resize( width_ * height_ * 4 );
+	levels_[1].resize( width_ * height_ * 4 );
+}
+
+void Denoiser::Denoise( const float * color, const float * albedo, const float * normal, const float * depth,
+	float * output, const DenoiserSettings & settings )
+{
+	if ( settings.iterations <= 0 )
+	{
+		memcpy( output, color, width_ * height_ * 4 * sizeof( float ) );
+		return;
+	}
+
+	// B3 spline
+	const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	// the fourth component of normals and albedo does not take part in the edge stopping
+	const __m128 xyz_mask = _mm_castsi128_ps( _mm_set_epi32( 0, -1, -1, -1 ) );
+
+	const float inv_sigma_normal2 = 1.0f / max( settings.sigma_normal * settings.sigma_normal, 1e-12f );
+	const float inv_sigma_albedo2 = 1.0f / max( settings.sigma_albedo * settings.sigma_albedo, 1e-12f );
+
+	const float * src = color;
+	for ( int level = 0; level < settings.iterations; ++level )
+	{
+		float * dst = ( level == settings.iterations - 1 ) ? output : levels_[level % 2].data();
+		const int step = 1 << level;
+
+		// the color differences shrink with every level, so does the tolerance
+		const float sigma_color = settings.sigma_color / step;
+		const float inv_sigma_color2 = 1.0f / max( sigma_color * sigma_color, 1e-12f );
+
+#pragma omp parallel for schedule(dynamic, 4)
+		for ( int y = 0; y < height_; ++y )
+		{
+			for ( int x = 0; x < width_; ++x )
+			{
+				const int p = y * width_ + x;
+				const __m128 color_p = _mm_loadu_ps( src + p * 4 );
+				const __m128 normal_p = _mm_loadu_ps( normal + p * 4 );
+				const __m128 albedo_p = _mm_loadu_ps( albedo + p * 4 );
+				const float depth_p = depth[p];
+				const bool hit_p = depth_p < FLT_MAX;
+				const float inv_sigma_depth = ( hit_p ) ? 1.0f / max( settings.sigma_depth * step * depth_p, 1e-12f ) : 0.0f;
+
+				__m128 sum = _mm_setzero_ps();
+				float weight_sum = 0.0f;
+
+				for ( int j = -2; j <= 2; ++j )
+				{
+					const int qy = y + j * step;
+					if ( qy < 0 || qy >= height_ )
+					{
+						continue;
+					}
+
+					for ( int i = -2; i <= 2; ++i )
+					{
+						const int qx = x + i * step;
+						if ( qx < 0 || qx >= width_ )
+						{
+							continue;
+						}
+
+						const int q = qy * width_ + qx;
+						const float depth_q = depth[q];
+
+						// the background and the geometry never blend together
+						if ( ( depth_q < FLT_MAX ) != hit_p )
+						{
+							continue;
+						}
+
+						const __m128 color_q = _mm_loadu_ps( src + q * 4 );
+						const __m128 normal_q = _mm_and_ps( _mm_sub_ps( _mm_loadu_ps( normal + q * 4 ), normal_p ), xyz_mask );
+						const __m128 albedo_q = _mm_and_ps( _mm_sub_ps( _mm_loadu_ps( albedo + q * 4 ), albedo_p ), xyz_mask );
+
+						const float exponent = SquaredLength( _mm_sub_ps( color_q, color_p ) ) * inv_sigma_color2 +
+							SquaredLength( normal_q ) * inv_sigma_normal2 +
+							SquaredLength( albedo_q ) * inv_sigma_albedo2 +
+							( ( hit_p ) ? fabsf( depth_q - depth_p ) * inv_sigma_depth : 0.0f );
+
+						const float weight = kernel[j + 2] * kernel[i + 2] * expf( -exponent );
+						sum = _mm_add_ps( sum, _mm_mul_ps( color_q, _mm_set1_ps( weight ) ) );
+						weight_sum += weight;
+					}
+				}
+
+				// the center tap always has a positive weight
+				_mm_storeu_ps( dst + p * 4, _mm_mul_ps( sum, _mm_set1_ps( 1.0f / weight_sum ) ) );
+			}
+		}
+
+		src = dst;
+	}
+}
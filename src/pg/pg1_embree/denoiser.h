@@ -0,0 +1,46 @@
+#ifndef DENOISER_H_
+#define DENOISER_H_
+
+struct DenoiserSettings
+{
+	int iterations{ 4 }; // number of a-trous levels, the footprint is 2^(iterations + 2) - 3 pixels
+	float sigma_color{ 0.5f }; // edge stopping by the noisy color, halved in every level
+	float sigma_normal{ 0.2f }; // edge stopping by the first hit normal
+	float sigma_depth{ 0.05f }; // edge stopping by the relative first hit distance (per pixel of the step)
+	float sigma_albedo{ 0.1f }; // edge stopping by the first hit albedo
+};
+
+/*! \class Denoiser
+\brief Edge-avoiding a-trous wavelet filter of the accumulated image.
+
+Every level convolves the image with the 5x5 B3 spline kernel whose taps are spread
+2^level pixels apart. The taps are weighted down across edges of the first hit
+normal, distance and albedo (the guide AOVs), so noise is removed from flat regions
+while geometry and texture edges stay sharp (Dammertz et al., 2010).
+
+Rows are filtered in parallel and each RGBA pixel is processed as a single SSE vector.
+*/
+class Denoiser
+{
+public:
+	Denoiser() {};
+	Denoiser( const int width, const int height );
+
+	/*! \fn void Denoise( const float * color, const float * albedo, const float * normal, const float * depth, float * output, const DenoiserSettings & settings )
+	\brief Filters the image, all buffers have width * height pixels.
+	\param color noisy RGBA image.
+	\param albedo RGBA albedo of the first hits (zero on a miss).
+	\param normal first hit normals, four floats per pixel (xyz and an unused component).
+	\param depth first hit distances (FLT_MAX on a miss).
+	\param output filtered RGBA image, must not overlap the inputs.
+	*/
+	void Denoise( const float * color, const float * albedo, const float * normal, const float * depth,
+		float * output, const DenoiserSettings & settings );
+
+private:
+	int width_{ 0 };
+	int height_{ 0 };
+	std::vector<float> levels_[2]; // ping-pong buffers of the intermediate levels
+};
+
+#endif
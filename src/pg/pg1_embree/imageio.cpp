@@ -0,0 +1,155 @@
+#include "stdafx.h"
+#include "imageio.h"
+#include "freeimage.h"
+
+int SavePFM( const std::string & file_name, const float * rgba, const int width, const int height )
+{
+	FILE * file = fopen( file_name.c_str(), "wb" );
+	if ( file == NULL )
+	{
+		printf( "Unable to write %s.\n", file_name.c_str() );
+
+		return -1;
+	}
+
+	// negative scale means little endian data
+	bool ok = fprintf( file, "PF\n%d %d\n-1.0\n", width, height ) > 0;
+
+	// PFM stores rows from the bottom to the top
+	std::vector<float> row( width * 3 );
+	for ( int y = height - 1; y >= 0 && ok; --y )
+	{
+		const float * src = rgba + y * width * 4;
+		for ( int x = 0; x < width; ++x )
+		{
+			row[x * 3] = src[x * 4];
+			row[x * 3 + 1] = src[x * 4 + 1];
+			row[x * 3 + 2] = src[x * 4 + 2];
+		}
+		ok = fwrite( row.data(), sizeof( float ), row.size(), file ) == row.size();
+	}
+
+	// buffered data may only fail to reach the disk here
+	ok = ( fclose( file ) == 0 ) && ok;
+	file = NULL;
+
+	if ( !ok )
+	{
+		printf( "Unable to write %s.\n", file_name.c_str() );
+
+		return -1;
+	}
+
+	return 0;
+}
+
+int SaveEXR( const std::string & file_name, const float * rgba, const int width, const int height )
+{
+	FIBITMAP * bitmap = FreeImage_AllocateT( FIT_RGBAF, width, height );
+	if ( bitmap == nullptr )
+	{
+		return -1;
+	}
+
+	// FreeImage stores the bottom row first
+	for ( int y = 0; y < height; ++y )
+	{
+		memcpy( FreeImage_GetScanLine( bitmap, height - 1 - y ), rgba + y * width * 4, width * 4 * sizeof( float ) );
+	}
+
+	const BOOL saved = FreeImage_Save( FIF_EXR, bitmap, file_name.c_str(), EXR_FLOAT );
+	FreeImage_Unload( bitmap );
+
+	if ( !saved )
+	{
+		printf( "Unable to write %s.\n", file_name.c_str() );
+
+		return -1;
+	}
+
+	return 0;
+}
+
+int SaveImage( const std::string & file_name, const float * rgba, const int width, const int height )
+{
+	const size_t dot = file_name.find_last_of( '.' );
+	std::string extension = ( dot != std::string::npos ) ? file_name.substr( dot + 1 ) : std::string();
+	for ( char & c : extension )
+	{
+		c = static_cast<char>( tolower( c ) );
+	}
+
+	if ( extension == "exr" )
+	{
+		return SaveEXR( file_name, rgba, width, height );
+	}
+
+	return SavePFM( file_name, rgba, width, height );
+}
+
+int LoadPFM( const std::string & file_name, std::vector<float> & rgba, int & width, int & height )
+{
+	FILE * file = fopen( file_name.c_str(), "rb" );
+	if ( file == NULL )
+	{
+		return -1;
+	}
+
+	char type[3] = { 0 };
+	float scale = 0.0f;
+	if ( fscanf( file, "%2s %d %d %f", type, &width, &height, &scale ) != 4 || type[0] != 'P' ||
+		( type[1] != 'F' && type[1] != 'f' ) || width <= 0 || height <= 0 || scale >= 0.0f )
+	{
+		// big endian (positive scale) files are not supported
+		printf( "Unsupported PFM file %s.\n", file_name.c_str() );
+		fclose( file );
+
+		return -1;
+	}
+	fgetc( file ); // single whitespace after the header
+
+	const int channels = ( type[1] == 'F' ) ? 3 : 1;
+	std::vector<float> row( width * channels );
+	rgba.resize( width * height * 4 );
+
+	for ( int y = height - 1; y >= 0; --y )
+	{
+		if ( fread( row.data(), sizeof( float ), row.size(), file ) != row.size() )
+		{
+			printf( "Truncated PFM file %s.\n", file_name.c_str() );
+			fclose( file );
+
+			return -1;
+		}
+
+		float * dst = &rgba[y * width * 4];
+		for ( int x = 0; x < width; ++x )
+		{
+			dst[x * 4] = row[x * channels];
+			dst[x * 4 + 1] = row[x * channels + ( channels - 1 ) / 2];
+			dst[x * 4 + 2] = row[x * channels + ( channels - 1 )];
+			dst[x * 4 + 3] = 1.0f;
+		}
+	}
+
+	fclose( file );
+	file = NULL;
+
+	return 0;
+}
+
+double RMSE( const float * rgba, const float * reference, const int width, const int height )
+{
+	double sum = 0.0;
+
+	for ( int i = 0; i < width * height; ++i )
+	{
+		for ( int c = 0; c < 3; ++c )
+		{
+			const double d = rgba[i * 4 + c] - reference[i * 4 + c];
+			sum += d * d;
+		}
+	}
+
+	return sqrt( sum / ( width * height * 3.0 ) );
+}
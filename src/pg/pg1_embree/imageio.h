@@ -0,0 +1,34 @@
+#ifndef IMAGE_IO_H_
+#define IMAGE_IO_H_
+
+/*! \fn int SavePFM( const std::string & file_name, const float * rgba, const int width, const int height )
+\brief Saves linear RGB values of the RGBA float image into the Portable Float Map file.
+The image is streamed row by row, only a single row is converted at a time.
+\param file_name full path to the file.
+\param rgba pixel data, the first row is the top one.
+\return 0 on success, -1 otherwise.
+*/
+int SavePFM( const std::string & file_name, const float * rgba, const int width, const int height );
+
+/*! \fn int SaveEXR( const std::string & file_name, const float * rgba, const int width, const int height )
+\brief Saves the RGBA float image into the OpenEXR file with 32-bit float channels.
+\note FreeImage needs the whole image in its own bitmap, so unlike SavePFM this holds one extra copy.
+\return 0 on success, -1 otherwise.
+*/
+int SaveEXR( const std::string & file_name, const float * rgba, const int width, const int height );
+
+/* saves the RGBA float image as PFM or EXR according to the extension of file_name */
+int SaveImage( const std::string & file_name, const float * rgba, const int width, const int height );
+
+/*! \fn int LoadPFM( const std::string & file_name, std::vector<float> & rgba, int & width, int & height )
+\brief Loads the Portable Float Map file (color or grayscale) into the RGBA float image.
+\param file_name full path to the file.
+\param rgba pixel data, the first row is the top one.
+\return 0 on success, -1 otherwise.
+*/
+int LoadPFM( const std::string & file_name, std::vector<float> & rgba, int & width, int & height );
+
+/* root mean square error of RGB components of two RGBA float images of the same size */
+double RMSE( const float * rgba, const float * reference, const int width, const int height );
+
+#endif
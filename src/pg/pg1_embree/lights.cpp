@@ -0,0 +1,328 @@
+#include "stdafx.h"
+#include "lights.h"
+#include "mymath.h"
+#include <algorithm>
+
+namespace
+{
+	inline float Luminance( const Vector3 & color )
+	{
+		return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+	}
+
+	inline bool Equal( const Vector3 & u, const Vector3 & v )
+	{
+		return u.x == v.x && u.y == v.y && u.z == v.z;
+	}
+
+	inline void Enclose( Vector3 & bounds_min, Vector3 & bounds_max, const Vector3 & p )
+	{
+		for ( int i = 0; i < 3; ++i )
+		{
+			bounds_min.data[i] = min( bounds_min.data[i], p.data[i] );
+			bounds_max.data[i] = max( bounds_max.data[i], p.data[i] );
+		}
+	}
+}
+
+float Light::Power() const
+{
+	switch ( type )
+	{
+	case LIGHT_POINT:
+		return 4.0f * float( M_PI ) * Luminance( color );
+
+	case LIGHT_SPOT:
+		// solid angle of the cone halfway between the inner and the outer one
+		return 2.0f * float( M_PI ) * ( 1.0f - 0.5f * ( cos_inner + cos_outer ) ) * Luminance( color );
+
+	case LIGHT_TRIANGLE:
+		return float( M_PI ) * 0.5f * edge1.CrossProduct( edge2 ).L2Norm() * Luminance( color );
+
+	default:
+		return Luminance( color );
+	}
+}
+
+void Light::Bounds( Vector3 & bounds_min, Vector3 & bounds_max ) const
+{
+	bounds_min = position;
+	bounds_max = position;
+
+	if ( type == LIGHT_TRIANGLE )
+	{
+		Enclose( bounds_min, bounds_max, position + edge1 );
+		Enclose( bounds_min, bounds_max, position + edge2 );
+	}
+}
+
+bool Light::operator==( const Light & other ) const
+{
+	return type == other.type && Equal( position, other.position ) && Equal( direction, other.direction ) &&
+		Equal( edge1, other.edge1 ) && Equal( edge2, other.edge2 ) && Equal( color, other.color ) &&
+		cos_inner == other.cos_inner && cos_outer == other.cos_outer;
+}
+
+bool Emits( const Material & material )
+{
+	const Vector3 & emission = material.emission;
+
+	return emission.x > 0.0f || emission.y > 0.0f || emission.z > 0.0f;
+}
+
+void AppendTriangleLights( Surface & surface, const Material & material, const Matrix3x3 & linear, const Vector3 & translation,
+	std::vector<Light> & lights )
+{
+	if ( !Emits( material ) )
+	{
+		return;
+	}
+
+	const Vector3 & emission = material.emission;
+
+	for ( int i = 0; i < surface.no_triangles(); ++i )
+	{
+		Triangle & triangle = surface.get_triangle( i );
+
+		Light light;
+		light.type = LIGHT_TRIANGLE;
+		light.position = linear * triangle.vertex( 0 ).position + translation;
+		light.edge1 = linear * ( triangle.vertex( 1 ).position - triangle.vertex( 0 ).position );
+		light.edge2 = linear * ( triangle.vertex( 2 ).position - triangle.vertex( 0 ).position );
+		light.color = emission;
+		lights.push_back( light );
+	}
+}
+
+void LightTree::Build( const std::vector<Light> & lights )
+{
+	lights_.clear();
+	nodes_.clear();
+	directional_.clear();
+
+	for ( const Light & light : lights )
+	{
+		if ( light.type == LIGHT_DIRECTIONAL )
+		{
+			directional_.push_back( light );
+		}
+		else if ( light.Power() > 0.0f )
+		{
+			lights_.push_back( light );
+		}
+	}
+
+	if ( !lights_.empty() )
+	{
+		nodes_.reserve( 2 * lights_.size() - 1 );
+		BuildNode( 0, static_cast<int>( lights_.size() ) );
+	}
+}
+
+int LightTree::BuildNode( const int first, const int last )
+{
+	const int index = static_cast<int>( nodes_.size() );
+	nodes_.push_back( Node() );
+
+	Node node;
+	node.power = 0.0f;
+	lights_[first].Bounds( node.bounds_min, node.bounds_max );
+
+	Vector3 centroid_min = node.bounds_min;
+	Vector3 centroid_max = node.bounds_max;
+	for ( int i = first; i < last; ++i )
+	{
+		Vector3 bounds_min, bounds_max;
+		lights_[i].Bounds( bounds_min, bounds_max );
+		Enclose( node.bounds_min, node.bounds_max, bounds_min );
+		Enclose( node.bounds_min, node.bounds_max, bounds_max );
+		Enclose( centroid_min, centroid_max, ( bounds_min + bounds_max ) * 0.5f );
+		node.power += lights_[i].Power();
+	}
+
+	if ( last - first == 1 )
+	{
+		node.light = first;
+		node.right = -1;
+	}
+	else
+	{
+		// median split of the centroids along their largest extent
+		Vector3 extent = centroid_max - centroid_min;
+		const int axis = extent.LargestComponent();
+		const int middle = ( first + last ) / 2;
+
+		std::nth_element( lights_.begin() + first, lights_.begin() + middle, lights_.begin() + last,
+			[axis]( const Light & a, const Light & b ) {
+			Vector3 a_min, a_max, b_min, b_max;
+			a.Bounds( a_min, a_max );
+			b.Bounds( b_min, b_max );
+			return a_min.data[axis] + a_max.data[axis] < b_min.data[axis] + b_max.data[axis];
+		} );
+
+		node.light = -1;
+		BuildNode( first, middle );
+		node.right = BuildNode( middle, last );
+	}
+
+	nodes_[index] = node;
+
+	return index;
+}
+
+float LightTree::Importance( const Node & node, const Vector3 & p, const Vector3 & n ) const
+{
+	// nothing reaches the point if the whole node is below its tangent plane
+	bool above = false;
+	for ( int i = 0; i < 8 && !above; ++i )
+	{
+		const Vector3 corner( ( i & 1 ) ? node.bounds_max.x : node.bounds_min.x,
+			( i & 2 ) ? node.bounds_max.y : node.bounds_min.y,
+			( i & 4 ) ? node.bounds_max.z : node.bounds_min.z );
+		above = ( corner - p ).DotProduct( n ) > 0.0f;
+	}
+
+	if ( !above )
+	{
+		return 0.0f;
+	}
+
+	// the distance to the center is not trusted closer than the radius of the node
+	const float d2 = ( ( node.bounds_min + node.bounds_max ) * 0.5f - p ).SqrL2Norm();
+	const float r2 = ( node.bounds_max - node.bounds_min ).SqrL2Norm() * 0.25f;
+
+	return node.power / max( max( d2, r2 ), 1e-6f );
+}
+
+bool LightTree::Sample( const Vector3 & p, const Vector3 & n, float u_select, const float u1, const float u2, LightSample & sample ) const
+{
+	const int no_choices = static_cast<int>( directional_.size() ) + ( ( nodes_.empty() ) ? 0 : 1 );
+	if ( no_choices == 0 )
+	{
+		return false;
+	}
+
+	// the tree as a whole is one of the choices beside the directional lights
+	const int choice = min( static_cast<int>( u_select * no_choices ), no_choices - 1 );
+	u_select = u_select * no_choices - choice;
+	float pmf = 1.0f / no_choices;
+
+	if ( choice < static_cast<int>( directional_.size() ) )
+	{
+		SampleLight( directional_[choice], p, u1, u2, sample );
+		sample.pdf *= pmf;
+
+		return true;
+	}
+
+	int index = 0;
+	while ( nodes_[index].light < 0 )
+	{
+		const float w_left = Importance( nodes_[index + 1], p, n );
+		const float w_right = Importance( nodes_[nodes_[index].right], p, n );
+		if ( w_left + w_right <= 0.0f )
+		{
+			return false;
+		}
+
+		// the random number is rescaled to the chosen interval and reused by the next level
+		const float p_left = w_left / ( w_left + w_right );
+		if ( u_select < p_left )
+		{
+			index = index + 1;
+			u_select /= p_left;
+			pmf *= p_left;
+		}
+		else
+		{
+			index = nodes_[index].right;
+			u_select = ( u_select - p_left ) / ( 1.0f - p_left );
+			pmf *= 1.0f - p_left;
+		}
+	}
+
+	if ( !SampleLight( lights_[nodes_[index].light], p, u1, u2, sample ) )
+	{
+		return false;
+	}
+	sample.pdf *= pmf;
+
+	return true;
+}
+
+bool LightTree::SampleLight( const Light & light, const Vector3 & p, const float u1, const float u2, LightSample & sample ) const
+{
+	if ( light.type == LIGHT_DIRECTIONAL )
+	{
+		sample.direction = -light.direction;
+		sample.distance = FLT_MAX;
+		sample.radiance = light.color;
+		sample.pdf = 1.0f;
+
+		return true;
+	}
+
+	Vector3 q = light.position;
+	if ( light.type == LIGHT_TRIANGLE )
+	{
+		// uniformly distributed point of the triangle
+		const float su = sqrtf( u1 );
+		q += light.edge1 * ( su * ( 1.0f - u2 ) ) + light.edge2 * ( su * u2 );
+	}
+
+	Vector3 d = q - p;
+	const float dist2 = d.SqrL2Norm();
+	if ( dist2 <= 0.0f )
+	{
+		return false;
+	}
+
+	sample.distance = sqrtf( dist2 );
+	sample.direction = d / sample.distance;
+
+	switch ( light.type )
+	{
+	case LIGHT_SPOT:
+	{
+		const float cos_axis = -sample.direction.DotProduct( light.direction );
+		if ( cos_axis <= light.cos_outer )
+		{
+			return false;
+		}
+
+		// smooth falloff between the cones
+		const float t = min( 1.0f, ( cos_axis - light.cos_outer ) / max( light.cos_inner - light.cos_outer, 1e-6f ) );
+		sample.radiance = light.color * ( t * t * ( 3.0f - 2.0f * t ) / dist2 );
+		sample.pdf = 1.0f;
+		break;
+	}
+
+	case LIGHT_TRIANGLE:
+	{
+		// two-sided emitter, the area density is converted to the solid angle one
+		const Vector3 normal = light.edge1.CrossProduct( light.edge2 );
+		const float double_area = normal.L2Norm();
+		const float cos_light = fabsf( normal.DotProduct( sample.direction ) ) / double_area;
+		if ( cos_light <= 0.0f )
+		{
+			return false;
+		}
+
+		sample.radiance = light.color;
+		sample.pdf = dist2 / ( cos_light * 0.5f * double_area );
+		break;
+	}
+
+	default:
+		sample.radiance = light.color / dist2;
+		sample.pdf = 1.0f;
+		break;
+	}
+
+	return true;
+}
+
+int LightTree::size() const
+{
+	return static_cast<int>( lights_.size() + directional_.size() );
+}
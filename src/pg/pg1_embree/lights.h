@@ -0,0 +1,95 @@
+#ifndef LIGHTS_H_
+#define LIGHTS_H_
+
+#include "vector3.h"
+#include "matrix3x3.h"
+#include "surface.h"
+
+enum LightType { LIGHT_POINT = 1, LIGHT_SPOT = 2, LIGHT_DIRECTIONAL = 3, LIGHT_TRIANGLE = 4 };
+
+/*! \struct Light
+\brief Single emitter, either given by the scene description or a triangle of an emissive surface.
+*/
+struct Light
+{
+	LightType type{ LIGHT_POINT };
+	Vector3 position; // of point and spot lights, first vertex of triangles
+	Vector3 direction; // unit axis of spot lights, unit direction of travel of directional lights
+	Vector3 edge1; // of triangles, v1 - v0
+	Vector3 edge2; // v2 - v0
+	Vector3 color; // intensity of point and spot lights, irradiance of directional lights, radiance of triangles
+	float cos_inner{ 1.0f }; // spot lights have full intensity inside this cone
+	float cos_outer{ 0.0f }; // and none outside of this one
+
+	/* emitted power (luminance) the light is selected by, infinite lights only get a relative weight */
+	float Power() const;
+	/* bounds of the emitter, directional lights have none */
+	void Bounds( Vector3 & bounds_min, Vector3 & bounds_max ) const;
+
+	bool operator==( const Light & other ) const;
+};
+
+/* true if surfaces of the material are area lights */
+bool Emits( const Material & material );
+
+/* appends a LIGHT_TRIANGLE of every triangle of the surface placed by linear and translation,
+nothing if the material does not emit */
+void AppendTriangleLights( Surface & surface, const Material & material, const Matrix3x3 & linear, const Vector3 & translation,
+	std::vector<Light> & lights );
+
+/* incident light from the selected emitter */
+struct LightSample
+{
+	Vector3 direction; // unit vector towards the light
+	float distance; // to the sampled point, FLT_MAX for directional lights
+	Vector3 radiance; // arriving along direction (irradiance for delta lights)
+	float pdf; // of the selection times the solid angle density of the point, just the selection for delta lights
+};
+
+/*! \class LightTree
+\brief Importance-based selection of one light out of many.
+
+Finite lights are stored in a binary BVH whose nodes keep the total power of their
+subtree. Sampling descends from the root, choosing each child by its power over the
+squared distance to the shading point and dropping children completely below its
+tangent plane, so a single light is picked in O(log N) steps with a probability close
+to its actual contribution. Directional lights do not fit into a spatial tree and are
+picked uniformly beside it. The tree is rebuilt between passes, render threads only sample it.
+*/
+class LightTree
+{
+public:
+	void Build( const std::vector<Light> & lights );
+
+	/*! \fn bool Sample( const Vector3 & p, const Vector3 & n, float u_select, const float u1, const float u2, LightSample & sample ) const
+	\brief Selects a light for the point p with the normal n and samples a point on it.
+	\param u_select, u1, u2 uniform random numbers from <0, 1), the first one picks the light.
+	\return false if no light can illuminate the point.
+	*/
+	bool Sample( const Vector3 & p, const Vector3 & n, float u_select, const float u1, const float u2, LightSample & sample ) const;
+
+	/* number of lights */
+	int size() const;
+
+private:
+	struct Node
+	{
+		Vector3 bounds_min;
+		Vector3 bounds_max;
+		float power;
+		int light; // index into lights_ in leaves, -1 in interior nodes
+		int right; // index of the right child, the left one immediately follows its parent
+	};
+
+	/* appends the subtree over lights [first, last) to nodes_, returns the index of its root */
+	int BuildNode( const int first, const int last );
+	/* estimated contribution of the subtree to the point */
+	float Importance( const Node & node, const Vector3 & p, const Vector3 & n ) const;
+	bool SampleLight( const Light & light, const Vector3 & p, const float u1, const float u2, LightSample & sample ) const;
+
+	std::vector<Light> lights_; // finite lights in the order of the leaves
+	std::vector<Node> nodes_;
+	std::vector<Light> directional_;
+};
+
+#endif
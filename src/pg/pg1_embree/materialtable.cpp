@@ -0,0 +1,94 @@
+#include "stdafx.h"
+#include "materialtable.h"
+#include <malloc.h>
+
+MaterialTable::~MaterialTable()
+{
+	_aligned_free( records_ );
+	records_ = nullptr;
+}
+
+unsigned int MaterialTable::Add( const Material * material )
+{
+	for ( int i = 0; i < size_; ++i )
+	{
+		if ( materials_[i] == material )
+		{
+			return i;
+		}
+	}
+
+	if ( size_ == capacity_ )
+	{
+		// the records are plain data, so the growth is a bare copy
+		const int capacity = max( 16, capacity_ * 2 );
+		MaterialRecord * records = static_cast<MaterialRecord *>( _aligned_malloc( capacity * sizeof( MaterialRecord ), 64 ) );
+		if ( records_ != nullptr )
+		{
+			memcpy( records, records_, size_ * sizeof( MaterialRecord ) );
+			_aligned_free( records_ );
+		}
+		records_ = records;
+		capacity_ = capacity;
+	}
+
+	materials_.push_back( material );
+	Compile( material, records_[size_] );
+
+	return size_++;
+}
+
+void MaterialTable::Refresh()
+{
+	for ( int i = 0; i < size_; ++i )
+	{
+		Compile( materials_[i], records_[i] );
+	}
+}
+
+Vector3 MaterialTable::Diffuse( const MaterialRecord & record, const Coord2f * tex_coord ) const
+{
+	if ( tex_coord && record.diffuse_texture != NO_TEXTURE )
+	{
+		const Color4f texel = textures_[record.diffuse_texture]->get_texel( tex_coord->u, tex_coord->v );
+
+		return Vector3( texel.r, texel.g, texel.b );
+	}
+
+	return record.diffuse;
+}
+
+int MaterialTable::size() const
+{
+	return size_;
+}
+
+unsigned short MaterialTable::AddTexture( Texture * texture )
+{
+	for ( size_t i = 0; i < textures_.size(); ++i )
+	{
+		if ( textures_[i] == texture )
+		{
+			return static_cast<unsigned short>( i );
+		}
+	}
+
+	textures_.push_back( texture );
+
+	return static_cast<unsigned short>( textures_.size() - 1 );
+}
+
+void MaterialTable::Compile( const Material * material, MaterialRecord & record )
+{
+	record.diffuse = material->diffuse;
+	record.ior = material->ior;
+	record.ambient = material->ambient;
+	record.shininess = material->shininess;
+	record.specular = material->specular;
+	record.reflectivity = material->reflectivity;
+	record.emission = material->emission;
+	record.shader = static_cast<unsigned short>( material->shader_ );
+
+	Texture * texture = material->get_texture( Material::kDiffuseMapSlot );
+	record.diffuse_texture = ( texture != nullptr ) ? AddTexture( texture ) : NO_TEXTURE;
+}
@@ -0,0 +1,72 @@
+#ifndef MATERIAL_TABLE_H_
+#define MATERIAL_TABLE_H_
+
+#include "material.h"
+
+/* value of MaterialRecord::diffuse_texture of untextured materials */
+#define NO_TEXTURE 0xffff
+
+/*! \struct MaterialRecord
+\brief Shading parameters of one material packed into a single cache line.
+
+Plain floats only, so the records can be copied with memcpy or split into per-field
+arrays. Textures are referenced by an index into the texture table of MaterialTable.
+*/
+struct RTC_ALIGN( 64 ) MaterialRecord
+{
+	Vector3 diffuse;
+	float ior;
+	Vector3 ambient;
+	float shininess;
+	Vector3 specular;
+	float reflectivity;
+	Vector3 emission;
+	unsigned short shader; // Shader
+	unsigned short diffuse_texture; // index into the texture table or NO_TEXTURE
+};
+
+static_assert( sizeof( MaterialRecord ) == 64, "MaterialRecord has to fill exactly one cache line" );
+
+/*! \class MaterialTable
+\brief Flat array of materials compiled from the editable Material objects.
+
+Materials get their IDs in the order of their first use. The table is only modified
+between passes, the render threads just index it.
+*/
+class MaterialTable
+{
+public:
+	MaterialTable() {};
+	~MaterialTable();
+
+	MaterialTable( const MaterialTable & ) = delete;
+	MaterialTable & operator=( const MaterialTable & ) = delete;
+
+	/* ID of the material, the material is compiled into the table on its first use */
+	unsigned int Add( const Material * material );
+	/* recompiles all records from their materials after they have been edited */
+	void Refresh();
+
+	const MaterialRecord & operator[]( const unsigned int id ) const
+	{
+		return records_[id];
+	}
+
+	/* diffuse color of the material, textured one if the material has a diffuse map */
+	Vector3 Diffuse( const MaterialRecord & record, const Coord2f * tex_coord ) const;
+
+	int size() const;
+
+private:
+	unsigned short AddTexture( Texture * texture );
+	void Compile( const Material * material, MaterialRecord & record );
+
+	MaterialRecord * records_{ nullptr }; // 64-byte aligned array of capacity_ records
+	int size_{ 0 };
+	int capacity_{ 0 };
+
+	std::vector<const Material *> materials_; // source of each record
+	std::vector<Texture *> textures_;
+};
+
+#endif
@@ -34,6 +34,12 @@ public:
 	Provede traspozici matice vzjemnou vmnou dk a sloupc.
 	*/
 	Matrix3x3 Transpose() const;
+
+	//! Inverze matice.
+	/*!
+	Vrt inverzn matici. Pro singulrn matici vrt matici identity.
+	*/
+	Matrix3x3 Inverse() const;
 	
 	//! Nastav zadan prvek matice na novou hodnotu.
 	/*!
@@ -0,0 +1,186 @@
+#include "stdafx.h"
+#include "microbenchmark.h"
+#include "raytracer.h"
+#include "texture.h"
+#include "Background.h"
+#include "camera.h"
+#include "mymath.h"
+#include "utils.h"
+#include "tonemapper.h"
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <algorithm>
+
+namespace
+{
+	// results are summed here so the compiler cannot drop the measured calls
+	volatile float sink = 0.0f;
+
+	double Median( std::vector<double> values )
+	{
+		std::sort( values.begin(), values.end() );
+		const size_t n = values.size();
+
+		return ( n % 2 == 1 ) ? values[n / 2] : 0.5 * ( values[n / 2 - 1] + values[n / 2] );
+	}
+
+	/* body( i ) is called for i = 0..calls-1 in every repetition and returns a value to be consumed */
+	template<typename Body>
+	MicroBenchmarkResult Measure( const char * name, const int calls, const int repetitions, Body body )
+	{
+		MicroBenchmarkResult result;
+		result.name = name;
+		result.calls = calls;
+		result.repetitions = repetitions;
+
+		// warm up caches and branch predictors
+		float sum = 0.0f;
+		for ( int i = 0; i < calls; ++i )
+		{
+			sum += body( i );
+		}
+
+		std::vector<double> times( repetitions );
+		for ( int r = 0; r < repetitions; ++r )
+		{
+			const auto t0 = std::chrono::high_resolution_clock::now();
+			for ( int i = 0; i < calls; ++i )
+			{
+				sum += body( i );
+			}
+			const std::chrono::duration<double, std::nano> dt = std::chrono::high_resolution_clock::now() - t0;
+			times[r] = dt.count() / calls;
+		}
+		sink = sink + sum;
+
+		result.median_ns = Median( times );
+		result.min_ns = *std::min_element( times.begin(), times.end() );
+
+		std::vector<double> deviations( repetitions );
+		for ( int r = 0; r < repetitions; ++r )
+		{
+			deviations[r] = fabs( times[r] - result.median_ns );
+		}
+		result.mad_ns = Median( deviations );
+
+		printf( "%-32s %8.2f ns/call (min %.2f, MAD %.2f)\n", name, result.median_ns, result.min_ns, result.mad_ns );
+
+		return result;
+	}
+
+	/* uniformly distributed direction on the unit sphere */
+	Vector3 RandomDirection()
+	{
+		const float z = Random( -1.0f, 1.0f );
+		const float phi = Random( 0.0f, 2.0f * float( M_PI ) );
+		const float r = sqrtf( 1.0f - z * z );
+
+		return Vector3( r * cosf( phi ), r * sinf( phi ), z );
+	}
+}
+
+int microbenchmark( const std::string & output_file, const int repetitions )
+{
+	const int calls = 1 << 16;
+	const int width = 640;
+	const int height = 480;
+
+	SeedRandom( 1 );
+
+	// inputs are prepared in advance so that only the measured function is timed
+	std::vector<Coord2f> tex_coords( calls );
+	std::vector<Vector3> directions( calls );
+	std::vector<Coord2f> pixels( calls );
+	std::vector<float> components( calls );
+	std::vector<std::string> obj_lines( calls );
+
+	for ( int i = 0; i < calls; ++i )
+	{
+		tex_coords[i] = Coord2f{ Random(), Random() };
+		directions[i] = RandomDirection();
+		pixels[i] = Coord2f{ Random( 0.0f, float( width ) ), Random( 0.0f, float( height ) ) };
+		// linear radiance is mostly dark, so sample the components with a quadratic falloff
+		const float ksi = Random();
+		components[i] = ksi * ksi;
+
+		char line[128] = { 0 };
+		switch ( i % 3 )
+		{
+		case 0: sprintf( line, "v %f %f %f", Random( -500.0f, 500.0f ), Random( -500.0f, 500.0f ), Random( -500.0f, 500.0f ) ); break;
+		case 1: sprintf( line, "vn %f %f %f", directions[i].x, directions[i].y, directions[i].z ); break;
+		case 2: sprintf( line, "vt %f %f 0.000000", tex_coords[i].u, tex_coords[i].v ); break;
+		}
+		obj_lines[i] = line;
+	}
+
+	Texture texture( "../../../data/background.jpg" );
+	Background background( "../../../data/background.jpg" );
+	const Camera camera( width, height, deg2rad( 45.0f ), Vector3( 3, 0, 0 ), Vector3( 0, 0, 0 ) );
+
+	if ( texture.width() == 0 )
+	{
+		printf( "Unable to load the benchmark texture.\n" );
+
+		return -1;
+	}
+
+	std::vector<MicroBenchmarkResult> results;
+
+	results.push_back( Measure( "Texture::get_texel", calls, repetitions, [&]( const int i ) {
+		return texture.get_texel( tex_coords[i].u, tex_coords[i].v ).r; } ) );
+
+	results.push_back( Measure( "Background::GetBackground", calls, repetitions, [&]( const int i ) {
+		return background.GetBackground( directions[i].x, directions[i].y, directions[i].z ).r; } ) );
+
+	results.push_back( Measure( "Camera::GenerateRay", calls, repetitions, [&]( const int i ) {
+		return camera.GenerateRay( pixels[i].u, pixels[i].v ).dir_x; } ) );
+
+	// a whole span per call including the jitter, compare with CameraRays::SIZE calls of GenerateRay
+	CameraRays span;
+	results.push_back( Measure( "Camera::GenerateRays (span)", calls, repetitions, [&]( const int i ) {
+		camera.GenerateRays( ( i * CameraRays::SIZE ) % width, i % height, CameraRays::SIZE, span );
+		return span.dir_x[0]; } ) );
+
+	results.push_back( Measure( "Raytracer::sampleHemisphere", calls, repetitions, [&]( const int i ) {
+		return Raytracer::sampleHemisphere( directions[i] ).x; } ) );
+
+	results.push_back( Measure( "Random", calls, repetitions, [&]( const int i ) {
+		return Random(); } ) );
+
+	results.push_back( Measure( "getSRGBColorValueForComponent", calls, repetitions, [&]( const int i ) {
+		return getSRGBColorValueForComponent( components[i] ); } ) );
+
+	const Tonemapper tonemapper;
+	results.push_back( Measure( "Tonemapper::EncodeSRGB", calls, repetitions, [&]( const int i ) {
+		return tonemapper.EncodeSRGB( components[i] ); } ) );
+
+	// the very call LoadOBJ makes for every v, vn and vt line
+	results.push_back( Measure( "LoadOBJ number parsing (sscanf)", calls, repetitions, [&]( const int i ) {
+		float values[3] = { 0.0f, 0.0f, 0.0f };
+		sscanf( obj_lines[i].c_str(), "%*s %f %f %f", &values[0], &values[1], &values[2] );
+		return values[0]; } ) );
+
+	FILE * file = fopen( output_file.c_str(), "wt" );
+	if ( file == NULL )
+	{
+		printf( "Unable to write %s.\n", output_file.c_str() );
+
+		return -1;
+	}
+
+	fprintf( file, "[" );
+	for ( size_t i = 0; i < results.size(); ++i )
+	{
+		const MicroBenchmarkResult & result = results[i];
+		fprintf( file, "%s\n\t{\"name\": \"%s\", \"calls\": %d, \"repetitions\": %d, \"median_ns\": %g, \"min_ns\": %g, \"mad_ns\": %g}",
+			( i > 0 ) ? "," : "", result.name.c_str(), result.calls, result.repetitions, result.median_ns, result.min_ns, result.mad_ns );
+	}
+	fprintf( file, "\n]\n" );
+
+	fclose( file );
+	file = NULL;
+
+	printf( "Micro-benchmark results written to %s.\n", output_file.c_str() );
+
+	return 0;
+}
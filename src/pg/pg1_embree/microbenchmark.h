@@ -0,0 +1,31 @@
+#ifndef MICRO_BENCHMARK_H_
+#define MICRO_BENCHMARK_H_
+
+/*! \struct MicroBenchmarkResult
+\brief Timing of a single hot function in nanoseconds per call.
+
+Each of the repetitions calls the function for all prepared inputs, the median
+over repetitions is robust against occasional preemption and the median absolute
+deviation tells how stable the measurement is.
+*/
+struct MicroBenchmarkResult
+{
+	std::string name;
+	int calls{ 0 }; // calls per repetition
+	int repetitions{ 0 };
+	double median_ns{ 0.0 };
+	double min_ns{ 0.0 };
+	double mad_ns{ 0.0 }; // median absolute deviation
+};
+
+/*! \fn int microbenchmark( const std::string & output_file, const int repetitions )
+\brief Measures Texture::get_texel, Background::GetBackground, Camera::GenerateRay(s),
+Raytracer::sampleHemisphere, Random, getSRGBColorValueForComponent, Tonemapper::EncodeSRGB
+and the number parsing of LoadOBJ on inputs with realistic distributions and writes the results as JSON.
+\param output_file full path to the JSON file.
+\param repetitions number of timed repetitions of each function.
+\return 0 on success.
+*/
+int microbenchmark( const std::string & output_file = "microbenchmark.json", const int repetitions = 21 );
+
+#endif
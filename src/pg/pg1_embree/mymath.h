@@ -4,6 +4,7 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <float.h>
+#include <string.h>
 #include "structs.h"
 
 template <class T> inline T sqr( const T x )
@@ -29,4 +30,44 @@ inline float deg2rad( const float x )
 	return x * float( M_PI ) / 180.0f;
 }
 
+/* MIS weight of the sample drawn from the strategy with pdf_a against the strategy with pdf_b */
+inline float power_heuristic( const float pdf_a, const float pdf_b )
+{
+	const float a2 = pdf_a * pdf_a;
+	const float b2 = pdf_b * pdf_b;
+
+	return ( a2 > 0.0f ) ? a2 / ( a2 + b2 ) : 0.0f;
+}
+
+/*! \fn Vector3 OffsetRayOrigin( const Vector3 & p, const Vector3 & n )
+\brief Moves the point p off its surface along the unit geometric normal n.
+
+Each coordinate is stepped by a number of ulps proportional to the matching component
+of the normal, so the offset scales with the magnitude of the point, near the origin a
+small fixed distance is used instead (Wchter, Binder: A Fast and Robust Method for Avoiding
+Self-Intersection, Ray Tracing Gems, 2019). Rays spawned from the result can use tnear = 0.
+*/
+inline Vector3 OffsetRayOrigin( const Vector3 & p, const Vector3 & n )
+{
+	const float origin = 1.0f / 32.0f;
+	const float float_scale = 1.0f / 65536.0f;
+	const float int_scale = 256.0f;
+
+	Vector3 q;
+	for ( int i = 0; i < 3; ++i )
+	{
+		// the ulp step works on the bit pattern, negative numbers grow by decrementing it
+		const int offset = static_cast<int>( int_scale * n.data[i] );
+		int bits;
+		memcpy( &bits, &p.data[i], sizeof( bits ) );
+		bits += ( p.data[i] < 0.0f ) ? -offset : offset;
+		float stepped;
+		memcpy( &stepped, &bits, sizeof( stepped ) );
+
+		q.data[i] = ( fabsf( p.data[i] ) < origin ) ? p.data[i] + float_scale * n.data[i] : stepped;
+	}
+
+	return q;
+}
+
 #endif
@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include "raystats.h"
+
+namespace
+{
+	// counters of all threads that have ever traced a ray, they are never freed as the threads live in the OpenMP pool
+	std::vector<RayStats *> registered_stats;
+	std::mutex registered_stats_lock;
+}
+
+void RayStats::Reset()
+{
+	memset( this, 0, sizeof( RayStats ) );
+}
+
+void RayStats::Add( const RayStats & stats )
+{
+	for ( int i = 0; i < RAY_TYPE_COUNT; ++i )
+	{
+		rays[i] += stats.rays[i];
+	}
+
+	for ( int i = 0; i < SHADER_COUNT; ++i )
+	{
+		hits[i] += stats.hits[i];
+	}
+
+	intersect_ticks += stats.intersect_ticks;
+	trace_ticks += stats.trace_ticks;
+}
+
+unsigned long long RayStats::path_rays() const
+{
+	return total_rays() - rays[RAY_SHADOW];
+}
+
+unsigned long long RayStats::total_rays() const
+{
+	unsigned long long total = 0;
+
+	for ( int i = 0; i < RAY_TYPE_COUNT; ++i )
+	{
+		total += rays[i];
+	}
+
+	return total;
+}
+
+RayStats & ThreadRayStats()
+{
+	static thread_local RayStats * stats = nullptr;
+
+	if ( stats == nullptr )
+	{
+		stats = new RayStats();
+		stats->Reset();
+
+		std::lock_guard<std::mutex> lock( registered_stats_lock );
+		registered_stats.push_back( stats );
+	}
+
+	return *stats;
+}
+
+void CollectRayStats( RayStats & stats )
+{
+	stats.Reset();
+
+	std::lock_guard<std::mutex> lock( registered_stats_lock );
+	for ( RayStats * thread_stats : registered_stats )
+	{
+		stats.Add( *thread_stats );
+		thread_stats->Reset();
+	}
+}
+
+float PassStats::mrays_per_second() const
+{
+	return ( pass_time > 0.0f ) ? static_cast<float>( totals.total_rays() / ( pass_time * 1e+6 ) ) : 0.0f;
+}
+
+float PassStats::average_path_depth() const
+{
+	return ( totals.rays[RAY_PRIMARY] > 0 ) ? static_cast<float>( totals.path_rays() ) / totals.rays[RAY_PRIMARY] : 0.0f;
+}
+
+float PassStats::intersect_fraction() const
+{
+	return ( totals.trace_ticks > 0 ) ? static_cast<float>( totals.intersect_ticks ) / totals.trace_ticks : 0.0f;
+}
+
+std::string PassStats::ToJSON() const
+{
+	char buffer[1024] = { 0 };
+	int length = sprintf( buffer, "{\"pass\": %d, \"pass_time\": %g, \"mrays_per_second\": %g, "
+		"\"average_path_depth\": %g, \"intersect_fraction\": %g, \"rays\": {",
+		pass, pass_time, mrays_per_second(), average_path_depth(), intersect_fraction() );
+
+	for ( int i = 0; i < RAY_TYPE_COUNT; ++i )
+	{
+		length += sprintf( buffer + length, "%s\"%s\": %I64u", ( i > 0 ) ? ", " : "",
+			RayTypeToString( static_cast<RayType>( i ) ), totals.rays[i] );
+	}
+
+	length += sprintf( buffer + length, "}, \"hits_per_shader\": [" );
+
+	for ( int i = 0; i < SHADER_COUNT; ++i )
+	{
+		length += sprintf( buffer + length, "%s%I64u", ( i > 0 ) ? ", " : "", totals.hits[i] );
+	}
+
+	sprintf( buffer + length, "]}" );
+
+	return std::string( buffer );
+}
+
+const char * RayTypeToString( const RayType type )
+{
+	switch ( type )
+	{
+	case RAY_PRIMARY: return "primary";
+	case RAY_SHADOW: return "shadow";
+	case RAY_REFLECTION: return "reflection";
+	case RAY_REFRACTION: return "refraction";
+	case RAY_DIFFUSE: return "diffuse";
+	default: return "unknown";
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef RAY_STATS_H_
+#define RAY_STATS_H_
+
+#include <intrin.h>
+
+/* kinds of rays distinguished by the statistics */
+enum RayType { RAY_PRIMARY = 0, RAY_SHADOW, RAY_REFLECTION, RAY_REFRACTION, RAY_DIFFUSE, RAY_TYPE_COUNT };
+
+/* upper bound of Shader values (see material.h) */
+#define SHADER_COUNT 8
+
+/*! \struct RayStats
+\brief Ray tracing counters.
+
+Every render thread increments its own instance returned by ThreadRayStats,
+so the counters need neither atomics nor locks. The producer thread sums them
+between passes by CollectRayStats.
+*/
+struct RayStats
+{
+	unsigned long long rays[RAY_TYPE_COUNT]; // number of traced rays of each type
+	unsigned long long hits[SHADER_COUNT]; // number of intersections with surfaces of each shader
+	unsigned long long intersect_ticks; // TSC ticks spent in rtcIntersect1 and rtcOccluded1
+	unsigned long long trace_ticks; // TSC ticks spent in trace_ray including the intersections
+
+	void Reset();
+	void Add( const RayStats & stats );
+
+	/* all rays except the shadow ones */
+	unsigned long long path_rays() const;
+	unsigned long long total_rays() const;
+};
+
+/* counters of the calling thread */
+RayStats & ThreadRayStats();
+
+/* sums counters of all threads into stats and resets them, only safe when the render threads are idle */
+void CollectRayStats( RayStats & stats );
+
+/*! \struct PassStats
+\brief Ray statistics of a single refinement pass.
+*/
+struct PassStats
+{
+	RayStats totals;
+	int pass{ 0 }; // index of the pass since the application start
+	float pass_time{ 0.0f }; // wall time of the pass (s)
+
+	float mrays_per_second() const;
+	/* average number of rays (excl. shadow rays) traced per primary ray */
+	float average_path_depth() const;
+	/* fraction of the trace_ray time spent in Embree queries */
+	float intersect_fraction() const;
+
+	/* single line JSON object */
+	std::string ToJSON() const;
+};
+
+const char * RayTypeToString( const RayType type );
+
+#endif
@@ -1,12 +1,16 @@
 #include "stdafx.h"
 #include "raytracer.h"
 #include "objloader.h"
+#include "sceneloader.h"
 #include "tutorials.h"
 #include "material.h"
 #include "background.h"
 #include "utils.h"
+#include "mymath.h"
+#include "imageio.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <algorithm>
 
 
 float SQR(float r) {
@@ -19,11 +23,25 @@ inline Vector3 reflect(const Vector3 & v, const Vector3 & n) {
 
 Raytracer::Raytracer(const int width, const int height,
 	const float fov_y, const Vector3 view_from, const Vector3 view_at,
-	const char * config) : SimpleGuiDX11(width, height)
+	const char * config, const SceneProfile profile) : SimpleGuiDX11(width, height)
 {
+	profile_ = profile;
 	InitDeviceAndScene(config);
 
 	camera_ = Camera(width, height, fov_y, view_from, view_at);
+	pending_camera_ = camera_;
+
+	// the reprojection needs the depth all the time, the rest is enabled on demand
+	depth_aov_ = aovs_.Register("depth", AOV_FLOAT, AOV_LAST, true, FLT_MAX, true);
+	normal_aov_ = aovs_.Register("normal", AOV_FLOAT4, AOV_AVERAGE);
+	albedo_aov_ = aovs_.Register("albedo", AOV_FLOAT4, AOV_AVERAGE);
+	material_id_aov_ = aovs_.Register("material_id", AOV_UINT, AOV_LAST);
+	geometry_id_aov_ = aovs_.Register("geometry_id", AOV_UINT, AOV_LAST);
+	cost_aov_ = aovs_.Register("cost", AOV_FLOAT, AOV_AVERAGE);
+	ray_count_aov_ = aovs_.Register("ray_count", AOV_FLOAT, AOV_AVERAGE);
+	display_.assign(width * height * 4, 0.0f);
+	denoised_.assign(width * height * 4, 0.0f);
+	denoiser_ = Denoiser(width, height);
 	background_ = Background("../../../data/background.jpg");
 }
 
@@ -45,12 +63,21 @@ int Raytracer::InitDeviceAndScene(const char * config)
 
 	// create a new scene bound to the specified device
 	scene_ = rtcNewScene(device_);
+	rtcSetSceneFlags(scene_, profile_.flags);
+	rtcSetSceneBuildQuality(scene_, profile_.scene_quality);
 
 	return S_OK;
 }
 
 int Raytracer::ReleaseDeviceAndScene()
 {
+	for (auto prototype : prototypes_)
+	{
+		rtcReleaseScene(prototype);
+	}
+	prototypes_.clear();
+	instances_.clear();
+
 	rtcReleaseScene(scene_);
 	rtcReleaseDevice(device_);
 
@@ -58,7 +85,7 @@ int Raytracer::ReleaseDeviceAndScene()
 }
 
 
-float Raytracer::trace_shadow_ray(const Vector3 & p, const Vector3 & l_d, const float dist, RTCIntersectContext contedxt) {
+float Raytracer::trace_shadow_ray(const Vector3 & p, const Vector3 & l_d, const float dist, RTCIntersectContext contedxt, const float time) {
 	RTCHit hit;
 	hit.geomID = RTC_INVALID_GEOMETRY_ID;
 	hit.primID = RTC_INVALID_GEOMETRY_ID;
@@ -72,10 +99,10 @@ float Raytracer::trace_shadow_ray(const Vector3 & p, const Vector3 & l_d, const
 	ray.dir_y = l_d.y;
 	ray.dir_z = l_d.z;
 
-	ray.tnear = 0.1f;
+	ray.tnear = 0.0f; // p is already off the surface, see SpawnPoint
 	ray.tfar = dist;
 
-	ray.time = 0.0f;
+	ray.time = time;
 
 	ray.mask = 0; // can be used to mask out some geometries for some rays
 	ray.id = 0; // identify a ray inside a callback function
@@ -83,80 +110,957 @@ float Raytracer::trace_shadow_ray(const Vector3 & p, const Vector3 & l_d, const
 
 	RTCIntersectContext context;
 	rtcInitIntersectContext(&context);
+
+	RayStats & stats = ThreadRayStats();
+	++stats.rays[RAY_SHADOW];
+	const unsigned long long t0 = __rdtsc();
 	rtcOccluded1(scene_, &context, &ray);
+	stats.intersect_ticks += __rdtsc() - t0;
 
 	if (ray.tfar < dist) {
 		return 0.00f;
 	}
-	else {
-		return 1.0f;
+	else {
+		return 1.0f;
+	}
+}
+
+unsigned int * Raytracer::AllocateMaterialIndices(const int no_triangles)
+{
+	// the deque never moves its arrays, so the user data pointers of other geometries stay valid
+	if (!free_material_indices_.empty())
+	{
+		std::vector<unsigned int> & indices = material_indices_[free_material_indices_.back()];
+		free_material_indices_.pop_back();
+		indices.assign(no_triangles, 0);
+
+		return indices.data();
+	}
+
+	material_indices_.emplace_back(no_triangles);
+
+	return material_indices_.back().data();
+}
+
+void Raytracer::ReleaseMaterialIndices(RTCGeometry mesh)
+{
+	const unsigned int * material_indices = static_cast<const unsigned int *>(rtcGetGeometryUserData(mesh));
+	if (material_indices == nullptr)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < material_indices_.size(); ++i)
+	{
+		if (material_indices_[i].data() == material_indices)
+		{
+			std::vector<unsigned int>().swap(material_indices_[i]);
+			free_material_indices_.push_back(i);
+			break;
+		}
+	}
+	rtcSetGeometryUserData(mesh, nullptr);
+}
+
+unsigned int Raytracer::AttachSurface(RTCScene scene, Surface * surface)
+{
+	return AttachSurfaces(scene, &surface, 1);
+}
+
+unsigned int Raytracer::AttachSurfaces(RTCScene scene, Surface * const * surfaces, const int no_surfaces)
+{
+	int no_triangles = 0;
+	for (int s = 0; s < no_surfaces; ++s)
+	{
+		no_triangles += surfaces[s]->no_triangles();
+	}
+
+	RTCGeometry mesh = rtcNewGeometry(device_, RTC_GEOMETRY_TYPE_TRIANGLE);
+	rtcSetGeometryBuildQuality(mesh, profile_.geometry_quality);
+
+	Vertex3f * vertices = (Vertex3f *)rtcSetNewGeometryBuffer(
+		mesh, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
+		sizeof(Vertex3f), 3 * no_triangles);
+
+	Triangle3ui * triangles = (Triangle3ui *)rtcSetNewGeometryBuffer(
+		mesh, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
+		sizeof(Triangle3ui), no_triangles);
+
+	// per-triangle material IDs, like the material buffer of the OptiX port
+	unsigned int * material_indices = AllocateMaterialIndices(no_triangles);
+	rtcSetGeometryUserData(mesh, material_indices);
+
+	rtcSetGeometryVertexAttributeCount(mesh, 2);
+
+	Normal3f * normals = (Normal3f *)rtcSetNewGeometryBuffer(
+		mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3,
+		sizeof(Normal3f), 3 * no_triangles);
+
+	Coord2f * tex_coords = (Coord2f *)rtcSetNewGeometryBuffer(
+		mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2,
+		sizeof(Coord2f), 3 * no_triangles);
+
+	// surfaces loop
+	for (int s = 0, t = 0, k = 0; s < no_surfaces; ++s)
+	{
+		Surface * surface = surfaces[s];
+		const unsigned int material_id = material_table_.Add(surface->get_material());
+
+		// triangles loop
+		for (int i = 0; i < surface->no_triangles(); ++i, ++t)
+		{
+			Triangle & triangle = surface->get_triangle(i);
+
+			// vertices loop
+			for (int j = 0; j < 3; ++j, ++k)
+			{
+				const Vertex & vertex = triangle.vertex(j);
+
+				vertices[k].x = vertex.position.x;
+				vertices[k].y = vertex.position.y;
+				vertices[k].z = vertex.position.z;
+
+				normals[k].x = vertex.normal.x;
+				normals[k].y = vertex.normal.y;
+				normals[k].z = vertex.normal.z;
+
+				tex_coords[k].u = vertex.texture_coords[0].u;
+				tex_coords[k].v = vertex.texture_coords[0].v;
+			}
+
+			triangles[t].v0 = k - 3;
+			triangles[t].v1 = k - 2;
+			triangles[t].v2 = k - 1;
+			material_indices[t] = material_id;
+		}
+	}
+
+	rtcCommitGeometry(mesh);
+	const unsigned int geom_id = rtcAttachGeometry(scene, mesh);
+	rtcReleaseGeometry(mesh);
+
+	return geom_id;
+}
+
+void Raytracer::LoadScene(const std::string file_name)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	const int no_surfaces = LoadOBJ(file_name.c_str(), surfaces_, materials_);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	load_time_ = std::chrono::duration<double>(t1 - t0).count();
+
+	if (profile_.merge_surfaces && !surfaces_.empty())
+	{
+		// one BVH over all groups instead of a tiny one per group
+		const unsigned int geom_id = AttachSurfaces(scene_, surfaces_.data(), static_cast<int>(surfaces_.size()));
+		for (auto surface : surfaces_)
+		{
+			RegisterObject(surface, geom_id, true);
+		}
+	}
+	else
+	{
+		// surfaces loop
+		for (auto surface : surfaces_)
+		{
+			RegisterObject(surface, AttachSurface(scene_, surface));
+		} // end of surfaces loop
+	}
+
+	t0 = std::chrono::high_resolution_clock::now();
+	rtcCommitScene(scene_);
+	t1 = std::chrono::high_resolution_clock::now();
+	build_time_ = std::chrono::duration<double>(t1 - t0).count();
+
+	printf("BVH build (%s/%s quality) took %s, OBJ load took %s.\n",
+		BuildQualityToString(profile_.scene_quality), BuildQualityToString(profile_.geometry_quality),
+		TimeToString(build_time_).c_str(), TimeToString(load_time_).c_str());
+}
+
+void Raytracer::LoadBackground(const std::string file_name)
+{
+	background_ = Background(file_name.c_str());
+}
+
+void Raytracer::LoadSceneDescription(const std::string file_name)
+{
+	SceneDescription description;
+	if (LoadSCN(file_name.c_str(), description) < 0)
+	{
+		return;
+	}
+
+	std::map<std::string, RTCScene> prototypes;
+	std::map<std::string, std::vector<Surface *>> prototype_surfaces;
+	load_time_ = 0.0;
+	build_time_ = 0.0;
+
+	auto load_surfaces = [&](const std::string & obj_file, RTCScene scene, std::vector<Surface *> & surfaces) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		LoadOBJ(obj_file.c_str(), surfaces, materials_);
+		load_time_ += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+
+		const bool merge = profile_.merge_surfaces && !surfaces.empty();
+		const unsigned int merged_id = (merge) ? AttachSurfaces(scene, surfaces.data(), static_cast<int>(surfaces.size())) : RTC_INVALID_GEOMETRY_ID;
+
+		for (auto surface : surfaces)
+		{
+			const unsigned int geom_id = (merge) ? merged_id : AttachSurface(scene, surface);
+			if (scene == scene_)
+			{
+				RegisterObject(surface, geom_id, merge);
+			}
+			surfaces_.push_back(surface);
+		}
+	};
+
+	// prototypes are committed once and shared by all of their placements
+	for (const auto & prototype : description.prototypes)
+	{
+		RTCScene scene = rtcNewScene(device_);
+		rtcSetSceneFlags(scene, profile_.flags);
+		rtcSetSceneBuildQuality(scene, profile_.scene_quality);
+
+		load_surfaces(prototype.second, scene, prototype_surfaces[prototype.first]);
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		rtcCommitScene(scene);
+		build_time_ += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+
+		prototypes_.push_back(scene);
+		prototypes[prototype.first] = scene;
+	}
+
+	for (const auto & mesh : description.meshes)
+	{
+		std::vector<Surface *> surfaces;
+		load_surfaces(mesh, scene_, surfaces);
+	}
+
+	for (const Light & light : description.lights)
+	{
+		AddLight(light);
+	}
+
+	for (const auto & placement : description.instances)
+	{
+		auto prototype = prototypes.find(placement.prototype);
+		if (prototype == prototypes.end())
+		{
+			printf("Unknown prototype '%s'.\n", placement.prototype.c_str());
+			continue;
+		}
+
+		AttachInstance(prototype->second, placement.linear, placement.translation);
+
+		// instances cannot be edited, so their emitters become fixed lights right away
+		std::vector<Light> lights;
+		for (Surface * surface : prototype_surfaces[placement.prototype])
+		{
+			AppendTriangleLights(*surface, *surface->get_material(), placement.linear, placement.translation, lights);
+		}
+		for (const Light & light : lights)
+		{
+			AddLight(light);
+		}
+	}
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	rtcCommitScene(scene_);
+	build_time_ += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+
+	printf("%I64u instance(s) of %I64u prototype(s), BVH build took %s, OBJ load took %s.\n",
+		description.instances.size(), prototypes_.size(), TimeToString(build_time_).c_str(), TimeToString(load_time_).c_str());
+}
+
+unsigned int Raytracer::AttachInstance(RTCScene prototype, const Matrix3x3 & linear, const Vector3 & translation)
+{
+	RTCGeometry instance = rtcNewGeometry(device_, RTC_GEOMETRY_TYPE_INSTANCE);
+	rtcSetGeometryInstancedScene(instance, prototype);
+
+	const float transform[12] = {
+		linear.get(0, 0), linear.get(1, 0), linear.get(2, 0),
+		linear.get(0, 1), linear.get(1, 1), linear.get(2, 1),
+		linear.get(0, 2), linear.get(1, 2), linear.get(2, 2),
+		translation.x, translation.y, translation.z };
+	rtcSetGeometryTransform(instance, 0, RTC_FORMAT_FLOAT3X4_COLUMN_MAJOR, transform);
+
+	rtcCommitGeometry(instance);
+	const unsigned int inst_id = rtcAttachGeometry(scene_, instance);
+	rtcReleaseGeometry(instance);
+
+	if (inst_id >= instances_.size())
+	{
+		instances_.resize(inst_id + 1);
+	}
+	instances_[inst_id].scene = prototype;
+	instances_[inst_id].normal_matrix = linear.Inverse().Transpose();
+
+	return inst_id;
+}
+
+RTCGeometry Raytracer::GetHitGeometry(const RTCHit & hit) const
+{
+	if (hit.instID[0] != RTC_INVALID_GEOMETRY_ID)
+	{
+		return rtcGetGeometry(instances_[hit.instID[0]].scene, hit.geomID);
+	}
+
+	return rtcGetGeometry(scene_, hit.geomID);
+}
+
+void Raytracer::ToWorldNormal(const RTCHit & hit, Normal3f & normal) const
+{
+	if (hit.instID[0] != RTC_INVALID_GEOMETRY_ID)
+	{
+		Vector3 n = instances_[hit.instID[0]].normal_matrix * Vector3(normal.x, normal.y, normal.z);
+		n.Normalize();
+
+		normal.x = n.x;
+		normal.y = n.y;
+		normal.z = n.z;
+	}
+}
+
+int Raytracer::RegisterObject(Surface * surface, const unsigned int geom_id, const bool merged)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	SceneObject object;
+	object.surface = surface;
+	object.material = surface->get_material();
+	object.geom_id = geom_id;
+	object.merged = merged;
+	objects_.push_back(object);
+	lights_dirty_ |= EmitsLight(object);
+
+	return static_cast<int>(objects_.size()) - 1;
+}
+
+bool Raytracer::Editable(const int handle) const
+{
+	// objects_lock_ must be held by the caller
+	if (objects_[handle].merged)
+	{
+		printf("Surface %d shares a merged geometry, it cannot be edited (see SceneProfile::merge_surfaces).\n", handle);
+		return false;
+	}
+
+	return true;
+}
+
+void Raytracer::MarkDirty(const int handle, const int flags)
+{
+	// objects_lock_ must be held by the caller, merged objects are rejected by Editable before
+	if (objects_[handle].dirty == 0)
+	{
+		dirty_objects_.push_back(handle);
+	}
+	objects_[handle].dirty |= flags;
+	// hidden emitters stay out of the light tree unless they are just being shown or hidden
+	lights_dirty_ |= EmitsLight(objects_[handle]) && (objects_[handle].visible || (flags & DIRTY_VISIBILITY) != 0);
+}
+
+bool Raytracer::EmitsLight(const SceneObject & object) const
+{
+	return object.material != nullptr && Emits(*object.material);
+}
+
+int Raytracer::AddSurface(Surface * surface, const Matrix3x3 & linear, const Vector3 & translation)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	SceneObject object;
+	object.surface = surface;
+	object.material = surface->get_material();
+	object.linear = linear;
+	object.translation = translation;
+	objects_.push_back(object);
+	surfaces_.push_back(surface);
+
+	const int handle = static_cast<int>(objects_.size()) - 1;
+	MarkDirty(handle, DIRTY_ADDED);
+
+	return handle;
+}
+
+void Raytracer::RemoveSurface(const int handle)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	if (!Editable(handle))
+	{
+		return;
+	}
+
+	if (!objects_[handle].removed)
+	{
+		objects_[handle].removed = true;
+		MarkDirty(handle, DIRTY_REMOVED);
+	}
+}
+
+void Raytracer::SetSurfaceTransform(const int handle, const Matrix3x3 & linear, const Vector3 & translation)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	if (!Editable(handle))
+	{
+		return;
+	}
+
+	objects_[handle].linear = linear;
+	objects_[handle].translation = translation;
+	MarkDirty(handle, DIRTY_TRANSFORM);
+}
+
+void Raytracer::SetSurfaceVisible(const int handle, const bool visible)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	if (!Editable(handle))
+	{
+		return;
+	}
+
+	if (objects_[handle].visible != visible)
+	{
+		objects_[handle].visible = visible;
+		MarkDirty(handle, DIRTY_VISIBILITY);
+	}
+}
+
+void Raytracer::SetSurfaceMaterial(const int handle, Material * material)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	if (!Editable(handle))
+	{
+		return;
+	}
+
+	if (objects_[handle].material != material)
+	{
+		// the former material may have been the emissive one
+		lights_dirty_ |= EmitsLight(objects_[handle]) && objects_[handle].visible;
+		objects_[handle].material = material;
+		MarkDirty(handle, DIRTY_MATERIAL);
+	}
+}
+
+void Raytracer::SetSurfaceMotion(const int handle, const Vector3 & motion)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	if (!Editable(handle))
+	{
+		return;
+	}
+
+	objects_[handle].motion = motion;
+	MarkDirty(handle, DIRTY_TRANSFORM);
+}
+
+void Raytracer::InvalidateMaterial(const Material * material)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	for (const auto & object : objects_)
+	{
+		if (object.material == material && object.visible && !object.removed)
+		{
+			// the emission may have been switched off, so the lights are rebuilt even for a non-emissive material
+			materials_dirty_ = true;
+			lights_dirty_ = true;
+			break;
+		}
+	}
+}
+
+void Raytracer::AddLight(const Light & light)
+{
+	std::lock_guard<std::mutex> lock(objects_lock_);
+
+	scene_lights_.push_back(light);
+	lights_dirty_ = true;
+}
+
+void Raytracer::SetObjectMaterial(const SceneObject & object)
+{
+	RTCGeometry mesh = rtcGetGeometry(scene_, object.geom_id);
+	unsigned int * material_indices = static_cast<unsigned int *>(rtcGetGeometryUserData(mesh));
+	std::fill(material_indices, material_indices + object.surface->no_triangles(), material_table_.Add(object.material));
+}
+
+bool Raytracer::UpdateObjectBuffers(SceneObject & object)
+{
+	RTCGeometry mesh = rtcGetGeometry(scene_, object.geom_id);
+
+	// a moving object has its end positions in the second time step, Embree interpolates them by the ray time
+	const int time_steps = (object.motion.SqrL2Norm() > 0.0f) ? 2 : 1;
+	const bool time_steps_changed = time_steps != object.time_steps;
+	if (time_steps_changed)
+	{
+		rtcSetGeometryTimeStepCount(mesh, time_steps);
+		if (time_steps == 2)
+		{
+			rtcSetNewGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX, 1, RTC_FORMAT_FLOAT3,
+				sizeof(Vertex3f), 3 * object.surface->no_triangles());
+		}
+		object.time_steps = time_steps;
+	}
+
+	Vertex3f * vertices = (Vertex3f *)rtcGetGeometryBufferData(mesh, RTC_BUFFER_TYPE_VERTEX, 0);
+	Vertex3f * end_vertices = (time_steps == 2) ? (Vertex3f *)rtcGetGeometryBufferData(mesh, RTC_BUFFER_TYPE_VERTEX, 1) : nullptr;
+	Normal3f * normals = (Normal3f *)rtcGetGeometryBufferData(mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0);
+	const Matrix3x3 normal_matrix = object.linear.Inverse().Transpose();
+
+	for (int i = 0, k = 0; i < object.surface->no_triangles(); ++i)
+	{
+		Triangle & triangle = object.surface->get_triangle(i);
+
+		for (int j = 0; j < 3; ++j, ++k)
+		{
+			const Vertex & vertex = triangle.vertex(j);
+
+			const Vector3 position = object.linear * vertex.position + object.translation;
+			vertices[k].x = position.x;
+			vertices[k].y = position.y;
+			vertices[k].z = position.z;
+
+			if (end_vertices != nullptr)
+			{
+				end_vertices[k].x = position.x + object.motion.x;
+				end_vertices[k].y = position.y + object.motion.y;
+				end_vertices[k].z = position.z + object.motion.z;
+			}
+
+			Vector3 normal = normal_matrix * vertex.normal;
+			normal.Normalize();
+			normals[k].x = normal.x;
+			normals[k].y = normal.y;
+			normals[k].z = normal.z;
+		}
+	}
+
+	rtcUpdateGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX, 0);
+	if (end_vertices != nullptr)
+	{
+		rtcUpdateGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX, 1);
+	}
+	rtcUpdateGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0);
+
+	return time_steps_changed;
+}
+
+void Raytracer::SetCamera(const Camera & camera)
+{
+	std::lock_guard<std::mutex> lock(camera_lock_);
+	pending_camera_ = camera;
+	camera_dirty_ = true;
+}
+
+int Raytracer::RenderSequence(const Sequence & sequence)
+{
+	const float frame_time = 1.0f / sequence.fps;
+	std::vector<float> frame_image; // copy of the last frame being written by writer
+	std::future<int> writer;
+	int failures = 0;
+
+	const auto t0 = std::chrono::high_resolution_clock::now();
+
+	for (int frame = sequence.first_frame; frame <= sequence.last_frame; ++frame)
+	{
+		const float time = frame * frame_time;
+		const auto frame_start = std::chrono::high_resolution_clock::now();
+
+		Vector3 view_from, view_at;
+		if (sequence.CameraAt(time, view_from, view_at))
+		{
+			std::lock_guard<std::mutex> lock(camera_lock_);
+			pending_camera_.SetView(view_from, view_at);
+			camera_dirty_ = true;
+		}
+
+		for (const TransformTrack & track : sequence.transforms)
+		{
+			Matrix3x3 linear;
+			Vector3 translation;
+			if (Sequence::TransformAt(track, time, linear, translation))
+			{
+				SetSurfaceTransform(track.handle, linear, translation);
+
+				if (sequence.motion_blur)
+				{
+					Matrix3x3 next_linear;
+					Vector3 next_translation;
+					Sequence::TransformAt(track, time + frame_time, next_linear, next_translation);
+					SetSurfaceMotion(track.handle, next_translation - translation);
+				}
+			}
+		}
+
+		// every frame starts from scratch, even if nothing has moved
+		ResetAccumulation();
+		for (int pass = 0; pass < sequence.spp; ++pass)
+		{
+			RenderPass(time);
+		}
+
+		const std::chrono::duration<float> frame_duration = std::chrono::high_resolution_clock::now() - frame_start;
+		printf("Frame %d rendered in %s (BVH update %s).\n", frame, TimeToString(frame_duration.count()).c_str(), TimeToString(build_time_).c_str());
+
+		// the previous frame has had the whole render time of this one to be written
+		if (writer.valid() && writer.get() != 0)
+		{
+			++failures;
+		}
+
+		char file_name[512] = { 0 };
+		snprintf(file_name, sizeof(file_name), sequence.output_pattern.c_str(), frame);
+		frame_image.assign(accumulator_, accumulator_ + width() * height() * 4);
+
+		const int w = width();
+		const int h = height();
+		writer = std::async(std::launch::async, [file_name = std::string(file_name), &frame_image, w, h]() {
+			return ::SaveImage(file_name, frame_image.data(), w, h);
+		});
+	}
+
+	if (writer.valid() && writer.get() != 0)
+	{
+		++failures;
+	}
+
+	const std::chrono::duration<float> duration = std::chrono::high_resolution_clock::now() - t0;
+	printf("%d frames rendered in %s.\n", sequence.last_frame - sequence.first_frame + 1, TimeToString(duration.count()).c_str());
+
+	return (failures == 0) ? 0 : -1;
+}
+
+bool Raytracer::Update()
+{
+	const bool scene_changed = UpdateScene();
+
+	Camera camera;
+	{
+		std::lock_guard<std::mutex> lock(camera_lock_);
+		if (!camera_dirty_)
+		{
+			return scene_changed;
+		}
+		camera = pending_camera_;
+		camera_dirty_ = false;
+	} // lock release
+
+	if (camera.SameView(camera_))
+	{
+		return scene_changed;
+	}
+
+	const Camera previous = camera_;
+	camera_ = camera;
+
+	// history of a modified scene cannot be reused, nor can the one of a different lens or shutter
+	if (scene_changed || !reprojection_.load(std::memory_order_relaxed) || !camera.SameOptics(previous))
+	{
+		return true;
+	}
+
+	// without the history the image has to start over
+	return !Reproject(previous, camera_);
+}
+
+void Raytracer::EndPass(const float pass_time)
+{
+	PassStats stats;
+	CollectRayStats(stats.totals);
+	stats.pass_time = pass_time;
+
+	{
+		std::lock_guard<std::mutex> lock(stats_lock_);
+		stats.pass = last_stats_.pass + 1;
+		last_stats_ = stats;
+	} // lock release
+
+	if (log_stats_.load(std::memory_order_relaxed))
+	{
+		FILE * file = fopen(stats_file_.c_str(), "at");
+		if (file != NULL)
+		{
+			fprintf(file, "%s\n", stats.ToJSON().c_str());
+			fclose(file);
+		}
+	}
+}
+
+PassStats Raytracer::last_stats()
+{
+	std::lock_guard<std::mutex> lock(stats_lock_);
+
+	return last_stats_;
+}
+
+double Raytracer::load_time() const
+{
+	return load_time_;
+}
+
+double Raytracer::build_time() const
+{
+	return build_time_;
+}
+
+bool Raytracer::Reproject(const Camera & from, const Camera & to)
+{
+	// the hits are rebuilt along the pin-hole ray of the pixel center, a thin lens samples other rays
+	const float * hit_distances = aovs_.floats(depth_aov_);
+	if (hit_distances == nullptr || from.aperture() > 0.0f)
+	{
+		return false;
+	}
+
+	const int w = width();
+	const int h = height();
+
+	std::vector<float> colors(w * h * 4, 0.0f);
+	std::vector<int> counts(w * h, 0);
+	std::vector<float> distances(w * h, FLT_MAX);
+	std::vector<int> sources(w * h, -1); // the other AOVs follow the colors
+
+	for (int y = 0; y < h; ++y)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			const int i = y * w + x;
+			if (sample_counts_[i] == 0)
+			{
+				continue;
+			}
+
+			const float distance = hit_distances[i];
+			const Vector3 dir = from.Direction(x + 0.5f, y + 0.5f);
+			// background depends on the direction only
+			const Vector3 p = (distance < FLT_MAX) ? from.view_from() + distance * dir : to.view_from() + dir;
+
+			float x_i, y_i;
+			if (!to.Project(p, x_i, y_i) || x_i < 0.0f || y_i < 0.0f || x_i >= w || y_i >= h)
+			{
+				continue;
+			}
+
+			const int j = int(y_i) * w + int(x_i);
+			const float new_distance = (distance < FLT_MAX) ? (p - to.view_from()).L2Norm() : FLT_MAX;
+
+			// several pixels may land on the same target, the nearest one wins
+			if (counts[j] > 0 && new_distance >= distances[j])
+			{
+				continue;
+			}
+
+			memcpy(&colors[j * 4], &accumulator_[i * 4], 4 * sizeof(float));
+			sources[j] = i;
+			counts[j] = min(sample_counts_[i], reprojection_history_);
+			distances[j] = new_distance;
+		}
+	}
+
+	// pixels nobody landed on keep zero counts and start over
+	memcpy(accumulator_, colors.data(), colors.size() * sizeof(float));
+	memcpy(sample_counts_, counts.data(), counts.size() * sizeof(int));
+	aovs_.Remap(sources);
+	// distances are measured from the new view
+	memcpy(aovs_.floats(depth_aov_), distances.data(), distances.size() * sizeof(float));
+
+	return true;
+}
+
+void Raytracer::Resolve(const float *& linear, const float *& display)
+{
+	{
+		std::lock_guard<std::mutex> lock(display_settings_lock_);
+		if (display_settings_dirty_)
+		{
+			denoiser_settings_ = pending_denoiser_settings_;
+			tonemap_settings_ = pending_tonemap_settings_;
+			display_settings_dirty_ = false;
+		}
+	} // lock release
+
+	// visualizations are saved as they are shown
+	display = display_.data();
+	linear = display_.data();
+
+	const AovHandle heatmap = (heatmap_.load(std::memory_order_relaxed) == HEATMAP_RAYS) ? ray_count_aov_ : cost_aov_;
+	if (heatmap_.load(std::memory_order_relaxed) != HEATMAP_OFF && aovs_.enabled(heatmap))
+	{
+		heatmap_top_.store(aovs_.ToHeatmap(heatmap, display_.data()), std::memory_order_relaxed);
+		return;
+	}
+
+	AovHandle shown;
+	shown.index = display_aov_.load(std::memory_order_relaxed);
+	if (shown.index > 0 && aovs_.enabled(shown))
+	{
+		aovs_.ToRGBA(shown, display_.data(), true);
+		return;
+	}
+
+	// the guides may not be allocated yet right after the denoiser was switched on
+	const float * image = accumulator_;
+	if (denoise_.load(std::memory_order_relaxed) && aovs_.enabled(normal_aov_) && aovs_.enabled(albedo_aov_) && aovs_.enabled(depth_aov_))
+	{
+		// the filter works on linear radiance
+		denoiser_.Denoise(accumulator_, aovs_.floats(albedo_aov_), aovs_.floats(normal_aov_), aovs_.floats(depth_aov_),
+			denoised_.data(), denoiser_settings_);
+		image = denoised_.data();
 	}
+
+	// saved images stay linear for compositing, only the screen gets the tonemapped values
+	tonemapper_.Apply(image, display_.data(), width() * height(), tonemap_settings_);
+	linear = image;
 }
 
-void Raytracer::LoadScene(const std::string file_name)
+
+bool Raytracer::UpdateScene()
 {
-	const int no_surfaces = LoadOBJ(file_name.c_str(), surfaces_, materials_);
+	std::lock_guard<std::mutex> lock(objects_lock_);
 
-	// surfaces loop
-	for (auto surface : surfaces_)
+	bool visible_change = materials_dirty_;
+	if (materials_dirty_)
 	{
-		RTCGeometry mesh = rtcNewGeometry(device_, RTC_GEOMETRY_TYPE_TRIANGLE);
+		material_table_.Refresh();
+		materials_dirty_ = false;
+	}
 
-		Vertex3f * vertices = (Vertex3f *)rtcSetNewGeometryBuffer(
-			mesh, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
-			sizeof(Vertex3f), 3 * surface->no_triangles());
+	// the objects already hold their new transforms and materials, so the lights need not wait for the geometry
+	if (lights_dirty_)
+	{
+		visible_change |= BuildLights();
+		lights_dirty_ = false;
+	}
 
-		Triangle3ui * triangles = (Triangle3ui *)rtcSetNewGeometryBuffer(
-			mesh, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
-			sizeof(Triangle3ui), surface->no_triangles());
+	if (dirty_objects_.empty())
+	{
+		return visible_change;
+	}
 
-		rtcSetGeometryUserData(mesh, (void*)(surface->get_material()));
+	for (const int handle : dirty_objects_)
+	{
+		SceneObject & object = objects_[handle];
+		const int dirty = object.dirty;
+		object.dirty = 0;
 
-		rtcSetGeometryVertexAttributeCount(mesh, 2);
+		if (object.removed)
+		{
+			if (object.geom_id != RTC_INVALID_GEOMETRY_ID)
+			{
+				// merged geometries cannot be removed, so nobody else reads the IDs
+				ReleaseMaterialIndices(rtcGetGeometry(scene_, object.geom_id));
+				rtcDetachGeometry(scene_, object.geom_id);
+				object.geom_id = RTC_INVALID_GEOMETRY_ID;
+				visible_change |= object.visible;
+			}
+			continue;
+		}
 
-		Normal3f * normals = (Normal3f *)rtcSetNewGeometryBuffer(
-			mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3,
-			sizeof(Normal3f), 3 * surface->no_triangles());
+		if (dirty & DIRTY_ADDED)
+		{
+			object.geom_id = AttachSurface(scene_, object.surface);
+			object.time_steps = 1;
+			RTCGeometry mesh = rtcGetGeometry(scene_, object.geom_id);
+			SetObjectMaterial(object);
+			UpdateObjectBuffers(object);
+			if (!object.visible)
+			{
+				rtcDisableGeometry(mesh);
+			}
+			rtcCommitGeometry(mesh);
+			visible_change |= object.visible;
+			continue;
+		}
 
-		Coord2f * tex_coords = (Coord2f *)rtcSetNewGeometryBuffer(
-			mesh, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2,
-			sizeof(Coord2f), 3 * surface->no_triangles());
+		RTCGeometry mesh = rtcGetGeometry(scene_, object.geom_id);
 
-		// triangles loop
-		for (int i = 0, k = 0; i < surface->no_triangles(); ++i)
+		if (dirty & DIRTY_TRANSFORM)
 		{
-			Triangle & triangle = surface->get_triangle(i);
+			// topology is unchanged, so the BVH of the moved geometry is only refitted,
+			// unless it starts or stops moving and so needs the other kind of BVH
+			const bool rebuild = UpdateObjectBuffers(object);
+			rtcSetGeometryBuildQuality(mesh, (rebuild) ? profile_.geometry_quality : RTC_BUILD_QUALITY_REFIT);
+		}
 
-			// vertices loop
-			for (int j = 0; j < 3; ++j, ++k)
+		if (dirty & DIRTY_MATERIAL)
+		{
+			SetObjectMaterial(object);
+		}
+
+		if (dirty & DIRTY_VISIBILITY)
+		{
+			if (object.visible)
 			{
-				const Vertex & vertex = triangle.vertex(j);
+				rtcEnableGeometry(mesh);
+			}
+			else
+			{
+				rtcDisableGeometry(mesh);
+			}
+			visible_change = true;
+		}
+		else if (object.visible)
+		{
+			visible_change |= (dirty & (DIRTY_TRANSFORM | DIRTY_MATERIAL)) != 0;
+		}
 
-				vertices[k].x = vertex.position.x;
-				vertices[k].y = vertex.position.y;
-				vertices[k].z = vertex.position.z;
+		rtcCommitGeometry(mesh);
+	}
+	dirty_objects_.clear();
 
-				normals[k].x = vertex.normal.x;
-				normals[k].y = vertex.normal.y;
-				normals[k].z = vertex.normal.z;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	rtcCommitScene(scene_);
+	build_time_ = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
 
-				tex_coords[k].u = vertex.texture_coords[0].u;
-				tex_coords[k].v = vertex.texture_coords[0].v;
-			}
+	return visible_change;
+}
+
+bool Raytracer::BuildLights()
+{
+	// objects_lock_ must be held by the caller
+	std::vector<Light> lights = scene_lights_;
 
-			triangles[i].v0 = k - 3;
-			triangles[i].v1 = k - 2;
-			triangles[i].v2 = k - 1;
+	for (const SceneObject & object : objects_)
+	{
+		if (object.removed || !object.visible || object.material == nullptr)
+		{
+			continue;
 		}
 
-		rtcCommitGeometry(mesh);
-		unsigned int geom_id = rtcAttachGeometry(scene_, mesh);
-		rtcReleaseGeometry(mesh);
-	} // end of surfaces loop
+		// every triangle of an emissive surface is an area light at the start of the frame
+		AppendTriangleLights(*object.surface, *object.material, object.linear, object.translation, lights);
+	}
 
-	rtcCommitScene(scene_);
+	if (lights.empty())
+	{
+		// the former fixed light of the shaders, bright enough for unit irradiance at the distance of 300
+		Light light;
+		light.type = LIGHT_POINT;
+		light.position = Vector3(50, -50, 300);
+		light.color = Vector3(1.0f, 1.0f, 1.0f) * (300.0f * 300.0f);
+		lights.push_back(light);
+	}
+
+	if (lights == built_lights_)
+	{
+		return false;
+	}
+
+	light_tree_.Build(lights);
+	built_lights_.swap(lights);
+
+	return true;
 }
 
+
 Color4f Raytracer::get_pixel(const int x, const int y, const float t)
 {
 
@@ -185,34 +1089,152 @@ Color4f Raytracer::get_pixel(const int x, const int y, const float t)
 		}
 	
 		return colorSum / static_cast<float>(samples);*/
-	offsetX = (x + Random());
-	offsetY = (y + Random());
+	// rows are rendered left to right by one thread, so the whole span is rendered at its first pixel
+	static thread_local Span span;
+	const int k = x % CameraRays::SIZE;
+	if (k == 0 || span.rays.y != y || span.rays.x0 != x - k)
+	{
+		RenderSpan(span, x - k, y);
+	}
+
+	return span.colors[k];
+}
+
+void Raytracer::RenderSpan(Span & span, const int x0, const int y)
+{
+	const int count = min(CameraRays::SIZE, width() - x0);
+	camera_.GenerateRays(x0, y, count, span.rays);
+	span.colors.assign(count, Color4f(0.0f, 0.0f, 0.0f, 1.0f));
+
+	RayStats & stats = ThreadRayStats();
+	const bool count_rays = aovs_.enabled(ray_count_aov_);
+	const bool deferred = deferred_shadows_.load(std::memory_order_relaxed);
+
+	PrimaryHit primary[CameraRays::SIZE];
+	unsigned long long ticks[CameraRays::SIZE];
+	unsigned long long rays[CameraRays::SIZE];
+
+	for (int k = 0; k < count; ++k)
+	{
+		RTCRayHitWithIor my_ray_hit;
+		my_ray_hit.ray_hit.ray = span.rays.ray(k);
+		my_ray_hit.ray_hit.hit = createEmptyHit();
+		my_ray_hit.ior = IOR_AIR;
+
+		PathState path;
+		path.shadows = (deferred) ? &span.shadows : nullptr;
+		path.pixel = k;
+
+		const unsigned long long rays0 = (count_rays) ? stats.total_rays() : 0;
+		++stats.rays[RAY_PRIMARY];
+		const unsigned long long t0 = __rdtsc();
+		span.colors[k] = trace_ray(my_ray_hit, 4, &primary[k], path);
+		ticks[k] = __rdtsc() - t0;
+		rays[k] = (count_rays) ? stats.total_rays() - rays0 : 0;
+	}
+
+	// the shadow rays of the span share one stream query, its cost is split evenly
+	const unsigned long long t0 = __rdtsc();
+	span.shadows.Resolve(scene_, span.colors.data());
+	const unsigned long long shadow_ticks = (__rdtsc() - t0) / count;
+
+	for (int k = 0; k < count; ++k)
+	{
+		ticks[k] += shadow_ticks;
+		stats.trace_ticks += ticks[k];
+
+		const int i = y * width() + x0 + k;
+		aovs_.Write(cost_aov_, i, static_cast<float>(ticks[k]));
+		if (count_rays)
+		{
+			aovs_.Write(ray_count_aov_, i, static_cast<float>(rays[k]));
+		}
+		aovs_.Write(depth_aov_, i, primary[k].distance);
+		aovs_.Write(normal_aov_, i, primary[k].normal);
+		aovs_.Write(albedo_aov_, i, primary[k].albedo);
+		aovs_.Write(geometry_id_aov_, i, primary[k].geometry_id);
+		aovs_.Write(material_id_aov_, i, primary[k].material_id);
+	}
+}
+
+Color4f Raytracer::ShadowedContribution(const Vector3 & p, const Vector3 & l_d, const float dist, const float time,
+	const Color4f & contribution, const PathState & path)
+{
+	if (path.shadows != nullptr)
+	{
+		// same segment as trace_shadow_ray
+		path.shadows->Push(p, l_d, 0.0f, dist, time, path.throughput * contribution, path.pixel);
+
+		return Color4f(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	RTCIntersectContext context;
+	rtcInitIntersectContext(&context);
 
-	my_ray_hit.ray_hit.ray = camera_.GenerateRay(offsetX, offsetY);
-	my_ray_hit.ray_hit.hit = createEmptyHit();
-	my_ray_hit.ior = IOR_AIR;
-	Color4f traced = trace_ray(my_ray_hit, 4);
+	return (trace_shadow_ray(p, l_d, dist, context, time) > 0.0f) ? contribution : Color4f(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+Color4f Raytracer::DirectLight(const RTCRay & ray, const Vector3 & p, const Vector3 & n, const Vector3 & ng, const Vector3 & brdf,
+	const PathState & path)
+{
+	LightSample light;
+	if (!SampleLight(p, n, light))
+	{
+		return Color4f(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	const float cos_l = light.direction.DotProduct(n);
+	if (cos_l <= 0.0f)
+	{
+		return Color4f(0.0f, 0.0f, 0.0f, 1.0f);
+	}
 
-	return traced;
+	const Vector3 lit = brdf * light.radiance * (cos_l / light.pdf);
+
+	// stops short of the sampled point, so an area light does not shadow itself
+	return ShadowedContribution(SpawnPoint(ray, ng, light.direction), light.direction, light.distance * 0.999f, ray.time,
+		Color4f(lit.x, lit.y, lit.z, 1.0f), path);
+}
+
+bool Raytracer::SampleLight(const Vector3 & p, const Vector3 & n, LightSample & sample) const
+{
+	// drawn one by one, so the sequence does not depend on the order of evaluation of arguments
+	const float u_select = Random();
+	const float u1 = Random();
+	const float u2 = Random();
+
+	return light_tree_.Sample(p, n, u_select, u1, u2, sample);
 }
 
-Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
+Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth, PrimaryHit * primary, const PathState & path) {
 	// TODO generate primary ray and perform ray cast on the scene
 	// setup a hit
 
 	// intersect ray with the scene
 	RTCIntersectContext context;
 	rtcInitIntersectContext(&context);
+
+	RayStats & stats = ThreadRayStats();
+	const unsigned long long t0 = __rdtsc();
 	rtcIntersect1(scene_, &context, &my_ray_hit.ray_hit);
+	stats.intersect_ticks += __rdtsc() - t0;
+
+	if (primary != nullptr && my_ray_hit.ray_hit.hit.geomID != RTC_INVALID_GEOMETRY_ID)
+	{
+		const RTCHit & hit = my_ray_hit.ray_hit.hit;
+		primary->distance = my_ray_hit.ray_hit.ray.tfar;
+		primary->geometry_id = (hit.instID[0] != RTC_INVALID_GEOMETRY_ID) ? hit.instID[0] : hit.geomID;
+	}
 
 	if (my_ray_hit.ray_hit.hit.geomID != RTC_INVALID_GEOMETRY_ID)
 	{
 		// we hit something
-		RTCGeometry geometry = rtcGetGeometry(scene_, my_ray_hit.ray_hit.hit.geomID);
+		RTCGeometry geometry = GetHitGeometry(my_ray_hit.ray_hit.hit);
 		Normal3f normal;
 		// get interpolated normal
 		rtcInterpolate0(geometry, my_ray_hit.ray_hit.hit.primID, my_ray_hit.ray_hit.hit.u, my_ray_hit.ray_hit.hit.v,
 			RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, &normal.x, 3);
+		ToWorldNormal(my_ray_hit.ray_hit.hit, normal);
 
 		//reorient_against(normal, my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z);
 
@@ -223,14 +1245,18 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 
 		tex_coord.v = 1.0f - tex_coord.v;
 
-		Material * material = (Material *)(rtcGetGeometryUserData(geometry));
+		const unsigned int material_id = static_cast<const unsigned int *>(rtcGetGeometryUserData(geometry))[my_ray_hit.ray_hit.hit.primID];
+		const MaterialRecord * material = &material_table_[material_id];
+		++stats.hits[material->shader];
 
 		//const Triangle & triangle = surfaces_[ray_hit]
-		Vector3 l_position = Vector3(50, -50, 300);
-
 		Vector3 p = getInterpolatedPoint(my_ray_hit.ray_hit.ray);
-		Vector3 l_d = l_position - p;
-		l_d.Normalize();
+
+		// spawned rays are pushed off the true (flat) triangle, the shading normal may point elsewhere
+		Normal3f geometric_normal = Normal3f{ my_ray_hit.ray_hit.hit.Ng_x, my_ray_hit.ray_hit.hit.Ng_y, my_ray_hit.ray_hit.hit.Ng_z };
+		ToWorldNormal(my_ray_hit.ray_hit.hit, geometric_normal);
+		Vector3 ng = Vector3(geometric_normal.x, geometric_normal.y, geometric_normal.z);
+		ng.Normalize();
 
 		Vector3 rd = Vector3(my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z);
 		Vector3 normal_v = Vector3(normal.x, normal.y, normal.z);
@@ -238,18 +1264,21 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 			normal_v *= -1;
 		}
 
-		if (depth <= 0) {
-			Color4f background = changeGamma(background_.GetBackground(my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z));
-
-
+		if (primary != nullptr) {
+			primary->normal = normal_v;
+			primary->material_id = material_id;
+			// texture lookup only if somebody reads it
+			if (aovs_.enabled(albedo_aov_)) {
+				primary->albedo = material_table_.Diffuse(*material, &tex_coord);
+			}
+		}
 
-			//return bck;
-			//return Color4f(1.0f,bck.g, bck.b,1.0f);
-			return Color4f(getSRGBColorValueForComponent(background.r), getSRGBColorValueForComponent(background.g), getSRGBColorValueForComponent(background.b), 1.0f);
+		if (depth <= 0) {
+			return GetBackground(Vector3(my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z));
 		}
 		// u,v tex_coord
 
-		switch (material->shader_)
+		switch (material->shader)
 		{
 		case Shader::NORMAL:
 		{
@@ -258,28 +1287,37 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 		}
 		case Shader::LAMBERT:
 		{
-			Vector3 diffuse = material->doDiffuse(&tex_coord);
-			float dot = l_d.DotProduct(normal_v);
-			Vector3 lambert_color = max(0, dot) * diffuse;
-			return Color4f(lambert_color.x, lambert_color.y, lambert_color.z, 1.0f);
+			Vector3 diffuse = material_table_.Diffuse(*material, &tex_coord);
+			return DirectLight(my_ray_hit.ray_hit.ray, p, normal_v, ng, diffuse, path);
 			break;
 		}
 		case Shader::PHONG:
 		{
+			const Color4f ambient = Color4f{ material->ambient.x, material->ambient.y, material->ambient.z, 1 } * material->reflectivity;
+
+			// one light picked by the light tree stands for all of them
+			LightSample light;
+			if (!SampleLight(p, normal_v, light)) {
+				return ambient;
+			}
+			const Vector3 & l_d = light.direction;
+
 			Vector3 v = Vector3(-my_ray_hit.ray_hit.ray.dir_x, -my_ray_hit.ray_hit.ray.dir_y, -my_ray_hit.ray_hit.ray.dir_z);
 			Vector3 l_r = reflect(l_d, normal_v);
 
-			float normal_dotProduct_l_d = normal_v.DotProduct(l_d);
+			float normal_dotProduct_l_d = max(0, normal_v.DotProduct(l_d));
 			// get diffuse
-			Vector3 diffuse = material->doDiffuse(&tex_coord);
+			Vector3 diffuse = material_table_.Diffuse(*material, &tex_coord);
 
-			const float enlight = trace_shadow_ray(p, l_d, l_d.L2Norm(), context);
-			Color4f final_color = Color4f{
-				(material->ambient.x + enlight * ((diffuse.x * normal_dotProduct_l_d) + pow(material->specular.x * v.DotProduct(l_r), material->shininess))),
-				(material->ambient.y + enlight * ((diffuse.y * normal_dotProduct_l_d) + pow(material->specular.y * v.DotProduct(l_r), material->shininess))),
-				(material->ambient.z + enlight * ((diffuse.z * normal_dotProduct_l_d) + pow(material->specular.z * v.DotProduct(l_r), material->shininess))),
+			const Color4f lit = (light.radiance / light.pdf) * Color4f{
+				((diffuse.x * normal_dotProduct_l_d) + pow(material->specular.x * v.DotProduct(l_r), material->shininess)),
+				((diffuse.y * normal_dotProduct_l_d) + pow(material->specular.y * v.DotProduct(l_r), material->shininess)),
+				((diffuse.z * normal_dotProduct_l_d) + pow(material->specular.z * v.DotProduct(l_r), material->shininess)),
 				1 } * material->reflectivity;
-			return final_color;
+
+			// stops short of the sampled point, so an area light does not shadow itself
+			return ambient + ShadowedContribution(SpawnPoint(my_ray_hit.ray_hit.ray, ng, l_d), l_d, light.distance * 0.999f,
+				my_ray_hit.ray_hit.ray.time, lit, path);
 
 			break;
 		}
@@ -289,7 +1327,6 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 
 			Vector3 diffuse = material->diffuse;
 			Vector3 rv = Vector3(-rd.x, -rd.y, -rd.z);
-			Vector3 vector = getInterpolatedPoint(my_ray_hit.ray_hit.ray);
 
 			float n1 = my_ray_hit.ior;
 			float n2 = ((n1 == IOR_AIR) ? material->ior : IOR_AIR);
@@ -302,7 +1339,7 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 			float refractComponent = 1.0f - SQR(n_divided) * (1.0f - SQR(cos_01));
 
 			
-			reflected_ray_hit = createRayWithEmptyHitAndIor(vector, rr, FLT_MAX, 0.001f, n2);
+			reflected_ray_hit = createRayWithEmptyHitAndIor(SpawnPoint(my_ray_hit.ray_hit.ray, ng, rr), rr, FLT_MAX, 0.0f, n2, my_ray_hit.ray_hit.ray.time);
 
 			if (refractComponent > 0) {
 				float cos_02 = sqrt(refractComponent);
@@ -316,24 +1353,42 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 				float part_refract = 1.0f - part_reflect;
 							   
 				// refracted ray
-				refracted_ray_hit = createRayWithEmptyHitAndIor(vector, rl, FLT_MAX, 0.001f, n2);
+				refracted_ray_hit = createRayWithEmptyHitAndIor(SpawnPoint(my_ray_hit.ray_hit.ray, ng, rl), rl, FLT_MAX, 0.0f, n2, my_ray_hit.ray_hit.ray.time);
+
+				// a single branch picked with the probability of its Fresnel weight, the weight and
+				// the probability cancel out, so the path stays a chain instead of a binary tree
+				if (fresnel_sampling_.load(std::memory_order_relaxed)) {
+					if (Random() < part_reflect) {
+						++stats.rays[RAY_REFLECTION];
+						return diffuse * trace_ray(reflected_ray_hit, depth - 1, nullptr, path.Scaled(diffuse));
+					}
+
+					++stats.rays[RAY_REFRACTION];
+					return diffuse * trace_ray(refracted_ray_hit, depth - 1, nullptr, path.Scaled(diffuse));
+				}
 
-				return (diffuse * trace_ray(reflected_ray_hit, depth - 1) * part_reflect) + (diffuse * trace_ray(refracted_ray_hit, depth - 1) * part_refract);
+				++stats.rays[RAY_REFLECTION];
+				++stats.rays[RAY_REFRACTION];
+				return (diffuse * trace_ray(reflected_ray_hit, depth - 1, nullptr, path.Scaled(diffuse * part_reflect)) * part_reflect) +
+					(diffuse * trace_ray(refracted_ray_hit, depth - 1, nullptr, path.Scaled(diffuse * part_refract)) * part_refract);
 
 				//FOR DEBUG
 				//return diffuse * trace_ray(myReflectedRTCRayHit, depth - 1);
 				//return diffuse * trace_ray(myRefractedRTCRayHit, depth - 1) * coefRefract;
 			}
 			else {
-				return diffuse * trace_ray(reflected_ray_hit, depth - 1);
+				++stats.rays[RAY_REFLECTION];
+				return diffuse * trace_ray(reflected_ray_hit, depth - 1, nullptr, path.Scaled(diffuse));
 			}
 
 		}
 		case Shader::PATHTRACER:
 		{
+			// the same test as Emits, the emitters are in the light tree then
 			Color4f emmision = Color4f{ material->emission.x, material->emission.y, material->emission.z, 1 };
-			if (emmision.r != 0 && emmision.g != 0 && emmision.b != 0) {
-				return emmision;
+			if (emmision.r > 0 || emmision.g > 0 || emmision.b > 0) {
+				// a diffuse bounce has already counted the light by sampling it
+				return (my_ray_hit.light_sampled) ? Color4f(0.0f, 0.0f, 0.0f, 1.0f) : emmision;
 			}
 
 			Vector3 r_d = Vector3(my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z);
@@ -342,11 +1397,37 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 
 			Vector3 omegaI = sampleHemisphere(normal_v);
 			float pdf = 1 / (2 * M_PI);
-
-			Color4f l_i = trace_ray(createRayWithEmptyHitAndIor(getInterpolatedPoint(my_ray_hit.ray_hit.ray), omegaI, FLT_MAX, 0.001f, IOR_AIR), depth - 1);
 			Vector3 fR = material->diffuse / M_PI;
 
-			Color4f final_color = fR * l_i * (normal_v.DotProduct(omegaI) / pdf);
+			// direct lighting of the scene lights, emitters hit by the bounce below are left out instead
+			Color4f direct = DirectLight(my_ray_hit.ray_hit.ray, p, normal_v, ng, fR, path);
+
+			// and from the environment, combined with the BSDF sample by MIS
+			const bool env_sampling = env_sampling_.load(std::memory_order_relaxed);
+			if (env_sampling)
+			{
+				float light_pdf = 0.0f;
+				const float u1 = Random();
+				const Vector3 omega_l = background_.Sample(u1, Random(), light_pdf);
+				const float cos_l = normal_v.DotProduct(omega_l);
+
+				if (light_pdf > 0.0f && cos_l > 0.0f)
+				{
+					direct += ShadowedContribution(SpawnPoint(my_ray_hit.ray_hit.ray, ng, omega_l), omega_l, FLT_MAX, my_ray_hit.ray_hit.ray.time,
+						fR * GetBackground(omega_l) * (cos_l * power_heuristic(light_pdf, pdf) / light_pdf), path);
+				}
+			}
+
+			RTCRayHitWithIor bounce = createRayWithEmptyHitAndIor(SpawnPoint(my_ray_hit.ray_hit.ray, ng, omegaI), omegaI, FLT_MAX, 0.0f, IOR_AIR,
+				my_ray_hit.ray_hit.ray.time);
+			bounce.pdf = (env_sampling) ? pdf : 0.0f;
+			bounce.light_sampled = true;
+
+			++stats.rays[RAY_DIFFUSE];
+			const Vector3 bounce_weight = fR * (normal_v.DotProduct(omegaI) / pdf);
+			Color4f l_i = trace_ray(bounce, depth - 1, nullptr, path.Scaled(bounce_weight));
+
+			Color4f final_color = direct + bounce_weight * l_i;
 
 			return final_color;
 			break;
@@ -363,12 +1444,10 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 			float n2 = ((n1 == IOR_AIR) ? material->ior : IOR_AIR);
 
 			Vector3 rr = (2.0f * (normal_v.DotProduct(rv))) * normal_v - rv;
-			Vector3 vector = getInterpolatedPoint(my_ray_hit.ray_hit.ray);
-
+			reflected_ray_hit = createRayWithEmptyHitAndIor(SpawnPoint(my_ray_hit.ray_hit.ray, ng, rr), rr, FLT_MAX, 0.0f, n2, my_ray_hit.ray_hit.ray.time);
 
-			reflected_ray_hit = createRayWithEmptyHitAndIor(vector, rr, FLT_MAX, 0.001f, n2);
-
-			return diffuse * trace_ray(reflected_ray_hit, depth - 1);
+			++stats.rays[RAY_REFLECTION];
+			return diffuse * trace_ray(reflected_ray_hit, depth - 1, nullptr, path.Scaled(diffuse));
 		}
 		case Shader::CLEAR_GLASS:
 		{
@@ -376,7 +1455,6 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 
 			Vector3 diffuse = material->diffuse;
 			Vector3 rv = Vector3(-rd.x, -rd.y, -rd.z);
-			Vector3 vector = getInterpolatedPoint(my_ray_hit.ray_hit.ray);
 
 			float n1 = my_ray_hit.ior;
 			float n2 = ((n1 == IOR_AIR) ? material->ior : IOR_AIR);
@@ -399,26 +1477,23 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 				float part_refract = 1.0f - part_reflect;
 
 				// Generate refracted ray
-				refracted_ray_hit = createRayWithEmptyHitAndIor(vector, rl, FLT_MAX, 0.001f, n2);
+				refracted_ray_hit = createRayWithEmptyHitAndIor(SpawnPoint(my_ray_hit.ray_hit.ray, ng, rl), rl, FLT_MAX, 0.0f, n2, my_ray_hit.ray_hit.ray.time);
 
-				return (diffuse * trace_ray(refracted_ray_hit, depth - 1) );
+				++stats.rays[RAY_REFRACTION];
+				return (diffuse * trace_ray(refracted_ray_hit, depth - 1, nullptr, path.Scaled(diffuse)) );
 
 				//FOR DEBUG
 				//return diffuse * trace_ray(myReflectedRTCRayHit, depth - 1);
 				//return diffuse * trace_ray(myRefractedRTCRayHit, depth - 1) * coefRefract;
 			}
 			else {
-				Color4f background = background_.GetBackground(my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z);
-
-				return Color4f(getSRGBColorValueForComponent(background.r), getSRGBColorValueForComponent(background.g), getSRGBColorValueForComponent(background.b), 1.0f);
+				return GetBackground(Vector3(my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z));
 			}
 		}
 		default:
 		{
-			Vector3 diff = material->doDiffuse(&tex_coord);
-			float dot = l_d.DotProduct(normal_v);
-			Vector3 temp = max(0, dot) * diff;
-			return Color4f(temp.x, temp.y, temp.z, 1.0f);
+			Vector3 diff = material_table_.Diffuse(*material, &tex_coord);
+			return DirectLight(my_ray_hit.ray_hit.ray, p, normal_v, ng, diff, path);
 			break;
 		}
 		}
@@ -426,12 +1501,27 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 		//return Color4f(0.0f, 0.0f, 0.0f, 1.0f);
 	}
 	else {
-		Color4f background = changeGamma(background_.GetBackground(my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z));
+		const Vector3 dir = Vector3(my_ray_hit.ray_hit.ray.dir_x, my_ray_hit.ray_hit.ray.dir_y, my_ray_hit.ray_hit.ray.dir_z);
+		Color4f background = GetBackground(dir);
+
+		// the direction could also have been drawn by the environment sampling of the previous vertex
+		if (my_ray_hit.pdf > 0.0f)
+		{
+			background = background * power_heuristic(my_ray_hit.pdf, background_.Pdf(dir));
+		}
 
-		return Color4f(getSRGBColorValueForComponent(background.r), getSRGBColorValueForComponent(background.g), getSRGBColorValueForComponent(background.b), 1.0f);
+		return background;
 	}
 }
 
+Color4f Raytracer::GetBackground(const Vector3 & dir) const
+{
+	// linear radiance, the display encoding is left to the resolve pass
+	const Color4f background = background_.GetBackground(dir.x, dir.y, dir.z);
+
+	return Color4f(background.r, background.g, background.b, 1.0f);
+}
+
 
 
 //float Raytracer::getGeometryTerm(Vector3 omegaI, RTCIntersectContext context, Vector3 vectorToLight, Vector3 intersectionPoint, Vector3 normal) {
@@ -462,10 +1552,30 @@ Color4f Raytracer::trace_ray(RTCRayHitWithIor my_ray_hit, int depth) {
 
 float  Raytracer::castShadowRay(RTCIntersectContext context, Vector3 vectorToLight, float dstToLight, Vector3 intersectionPoint, Vector3 normal) {
 	RTCRay rayFromIntersectPointToLight = createRay(intersectionPoint, vectorToLight, dstToLight, 0.1f);
+
+	RayStats & stats = ThreadRayStats();
+	++stats.rays[RAY_SHADOW];
+	const unsigned long long t0 = __rdtsc();
 	rtcOccluded1(scene_, &context, &rayFromIntersectPointToLight);
+	stats.intersect_ticks += __rdtsc() - t0;
 	return rayFromIntersectPointToLight.tfar < dstToLight ? 0.0f : 1.0f;
 }
 
+Vector3 Raytracer::SpawnPoint(const RTCRay & ray, const Vector3 & ng, const Vector3 & dir)
+{
+	const Vector3 p = getInterpolatedPoint(ray);
+
+	// org + tfar * dir is off the triangle by a few ulps of its terms (even if they cancel out),
+	// that bound along the normal comes first, then the ulp step of the point itself
+	const float error = 8.0f * FLT_EPSILON * (
+		fabsf(ng.x) * (fabsf(ray.org_x) + fabsf(ray.tfar * ray.dir_x)) +
+		fabsf(ng.y) * (fabsf(ray.org_y) + fabsf(ray.tfar * ray.dir_y)) +
+		fabsf(ng.z) * (fabsf(ray.org_z) + fabsf(ray.tfar * ray.dir_z)));
+	const Vector3 n = (dir.DotProduct(ng) < 0.0f) ? -ng : ng;
+
+	return OffsetRayOrigin(p + n * error, n);
+}
+
 Vector3 Raytracer::getInterpolatedPoint(RTCRay ray) {
 	return Vector3{
 			ray.org_x + ray.tfar * ray.dir_x,
@@ -475,7 +1585,7 @@ Vector3 Raytracer::getInterpolatedPoint(RTCRay ray) {
 }
 
 
-Vector3 Raytracer::sampleHemisphere(Vector3 normal) {
+Vector3 Raytracer::sampleHemisphere(const Vector3 & normal) {
 	float randomU = Random();
 	float randomV = Random();
 
@@ -514,11 +1624,267 @@ int Raytracer::Ui()
 	// we use a Begin/End pair to created a named window
 	ImGui::Begin("Ray Tracer Params");
 
-	ImGui::Text("Surfaces = %d", surfaces_.size());
+	int no_surfaces = 0;
+	{
+		// AddSurface may grow the list meanwhile
+		std::lock_guard<std::mutex> lock(objects_lock_);
+		no_surfaces = static_cast<int>(surfaces_.size());
+	} // lock release
+	ImGui::Text("Surfaces = %d", no_surfaces);
 	ImGui::Text("Materials = %d", materials_.size());
 	ImGui::Separator();
+	ImGui::Text("BVH quality = %s/%s", BuildQualityToString(profile_.scene_quality), BuildQualityToString(profile_.geometry_quality));
+	ImGui::Text("BVH build = %s, OBJ load = %s", TimeToString(build_time_).c_str(), TimeToString(load_time_).c_str());
+	const float pass_time = pass_time_.load(std::memory_order_relaxed);
+	ImGui::Text("Last pass = %s (build/pass = %0.2f)", TimeToString(pass_time).c_str(), (pass_time > 0.0f) ? build_time_ / pass_time : 0.0);
+	ImGui::Separator();
 	ImGui::Checkbox("Vsync", &vsync_);
 
+	bool reprojection = reprojection_.load(std::memory_order_relaxed);
+	if (ImGui::Checkbox("Reproject on camera move", &reprojection))
+	{
+		reprojection_.store(reprojection, std::memory_order_relaxed);
+	}
+	ImGui::SliderFloat("Camera speed", &camera_speed_, 0.01f, 10.0f, "%.2f", 2.0f);
+
+	if (ImGui::CollapsingHeader("Depth of field"))
+	{
+		std::lock_guard<std::mutex> lock(camera_lock_);
+		float aperture = pending_camera_.aperture();
+		float focal_distance = pending_camera_.focal_distance();
+
+		bool changed = ImGui::SliderFloat("Aperture", &aperture, 0.0f, 50.0f, "%.2f", 3.0f);
+		changed |= ImGui::SliderFloat("Focal distance", &focal_distance, 1.0f, 5000.0f, "%.1f", 3.0f);
+		if (ImGui::Button("Focus at target"))
+		{
+			focal_distance = (pending_camera_.view_at() - pending_camera_.view_from()).L2Norm();
+			changed = true;
+		}
+		ImGui::TextDisabled("Aperture is the lens radius in world units, 0 is a pin-hole.");
+
+		if (changed)
+		{
+			pending_camera_.SetThinLens(aperture, focal_distance);
+			camera_dirty_ = true;
+		}
+	} // lock release
+
+	if (ImGui::CollapsingHeader("Motion blur"))
+	{
+		std::lock_guard<std::mutex> lock(camera_lock_);
+		float shutter[2] = { pending_camera_.shutter_open(), pending_camera_.shutter_close() };
+
+		if (ImGui::SliderFloat2("Shutter", shutter, 0.0f, 1.0f, "%.2f"))
+		{
+			pending_camera_.SetShutter(shutter[0], shutter[1]);
+			camera_dirty_ = true;
+		}
+		ImGui::TextDisabled("Surfaces move by their motion vector over the frame <0, 1>.");
+	} // lock release
+
+	bool deferred_shadows = deferred_shadows_.load(std::memory_order_relaxed);
+	if (ImGui::Checkbox("Deferred shadow rays", &deferred_shadows))
+	{
+		deferred_shadows_.store(deferred_shadows, std::memory_order_relaxed);
+	}
+
+	bool fresnel_sampling = fresnel_sampling_.load(std::memory_order_relaxed);
+	if (ImGui::Checkbox("Stochastic Fresnel (glass)", &fresnel_sampling))
+	{
+		fresnel_sampling_.store(fresnel_sampling, std::memory_order_relaxed);
+	}
+
+	bool env_sampling = env_sampling_.load(std::memory_order_relaxed);
+	if (ImGui::Checkbox("Environment sampling (MIS)", &env_sampling))
+	{
+		env_sampling_.store(env_sampling, std::memory_order_relaxed);
+	}
+
+	if (ImGui::CollapsingHeader("Denoiser"))
+	{
+		bool denoise = denoise_.load(std::memory_order_relaxed);
+		if (ImGui::Checkbox("A-trous filter", &denoise))
+		{
+			denoise_.store(denoise, std::memory_order_relaxed);
+			if (denoise)
+			{
+				aovs_.RequestEnabled(normal_aov_, true);
+				aovs_.RequestEnabled(albedo_aov_, true);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(display_settings_lock_);
+		bool changed = ImGui::SliderInt("Levels", &pending_denoiser_settings_.iterations, 1, 6);
+		changed |= ImGui::SliderFloat("Sigma color", &pending_denoiser_settings_.sigma_color, 0.01f, 4.0f, "%.2f", 2.0f);
+		changed |= ImGui::SliderFloat("Sigma normal", &pending_denoiser_settings_.sigma_normal, 0.01f, 1.0f, "%.2f");
+		changed |= ImGui::SliderFloat("Sigma depth", &pending_denoiser_settings_.sigma_depth, 0.001f, 0.5f, "%.3f", 2.0f);
+		changed |= ImGui::SliderFloat("Sigma albedo", &pending_denoiser_settings_.sigma_albedo, 0.01f, 1.0f, "%.2f");
+		display_settings_dirty_ |= changed;
+	}
+
+	if (ImGui::CollapsingHeader("Tonemapping"))
+	{
+		std::lock_guard<std::mutex> lock(display_settings_lock_);
+		bool changed = ImGui::SliderFloat("Exposure (EV)", &pending_tonemap_settings_.exposure, -8.0f, 8.0f, "%.1f");
+		changed |= ImGui::RadioButton("Linear", &pending_tonemap_settings_.tonemap, TONEMAP_NONE); ImGui::SameLine();
+		changed |= ImGui::RadioButton("Reinhard", &pending_tonemap_settings_.tonemap, TONEMAP_REINHARD); ImGui::SameLine();
+		changed |= ImGui::RadioButton("ACES", &pending_tonemap_settings_.tonemap, TONEMAP_ACES);
+		changed |= ImGui::Checkbox("sRGB", &pending_tonemap_settings_.srgb);
+		display_settings_dirty_ |= changed;
+	}
+
+	if (ImGui::CollapsingHeader("Cost heatmap"))
+	{
+		int heatmap = heatmap_.load(std::memory_order_relaxed);
+		ImGui::RadioButton("Off", &heatmap, HEATMAP_OFF); ImGui::SameLine();
+		ImGui::RadioButton("Cycles", &heatmap, HEATMAP_CYCLES); ImGui::SameLine();
+		ImGui::RadioButton("Rays", &heatmap, HEATMAP_RAYS);
+		if (heatmap != heatmap_.load(std::memory_order_relaxed))
+		{
+			heatmap_.store(heatmap, std::memory_order_relaxed);
+			if (heatmap != HEATMAP_OFF)
+			{
+				aovs_.RequestEnabled((heatmap == HEATMAP_RAYS) ? ray_count_aov_ : cost_aov_, true);
+			}
+		}
+		// the top of the ramp is the 99th percentile of the selected cost
+		ImGui::Text("Red = %.0f %s per sample", heatmap_top_.load(std::memory_order_relaxed), (heatmap == HEATMAP_RAYS) ? "rays" : "cycles");
+		ImGui::TextDisabled("Saved images show the heatmap, Save AOVs writes the raw costs.");
+	}
+
+	if (ImGui::CollapsingHeader("AOVs"))
+	{
+		int display = display_aov_.load(std::memory_order_relaxed);
+		for (int i = 0; i < aovs_.count(); ++i)
+		{
+			AovHandle handle;
+			handle.index = i;
+
+			bool enabled = aovs_.requested(handle);
+			if (aovs_.required(handle))
+			{
+				// cannot be switched off
+				ImGui::TextDisabled("[x] %s", aovs_.name(handle).c_str());
+			}
+			else if (ImGui::Checkbox(aovs_.name(handle).c_str(), &enabled))
+			{
+				aovs_.RequestEnabled(handle, enabled);
+			}
+			ImGui::SameLine(160.0f);
+			ImGui::PushID(i);
+			ImGui::RadioButton("show", &display, i);
+			ImGui::PopID();
+		}
+		display_aov_.store(display, std::memory_order_relaxed);
+
+		if (ImGui::Button("Save AOVs"))
+		{
+			RequestSaveAovs(output_file_);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Output"))
+	{
+		ImGui::InputText("File (.pfm/.exr)", output_file_, sizeof(output_file_));
+		if (ImGui::Button("Save"))
+		{
+			RequestSave(output_file_);
+		}
+		if (ImGui::SliderFloat("Save image every (s)", &image_save_interval_, 0.0f, 600.0f, "%.0f"))
+		{
+			SetAutoSave(output_file_, image_save_interval_);
+		}
+
+		ImGui::Separator();
+		ImGui::InputText("Checkpoint", checkpoint_file_name_, sizeof(checkpoint_file_name_));
+		if (ImGui::SliderFloat("Checkpoint every (s)", &checkpoint_period_, 0.0f, 600.0f, "%.0f"))
+		{
+			SetCheckpointInterval(checkpoint_file_name_, checkpoint_period_);
+		}
+		if (ImGui::Button("Resume"))
+		{
+			RequestResume(checkpoint_file_name_);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Ray statistics"))
+	{
+		PassStats stats;
+		{
+			std::lock_guard<std::mutex> lock(stats_lock_);
+			stats = last_stats_;
+		} // lock release
+
+		ImGui::Text("Pass %d: %.2f Mrays/s", stats.pass, stats.mrays_per_second());
+		for (int i = 0; i < RAY_TYPE_COUNT; ++i)
+		{
+			ImGui::Text("%s rays = %I64u", RayTypeToString(static_cast<RayType>(i)), stats.totals.rays[i]);
+		}
+		ImGui::Text("Avg. path depth = %.2f", stats.average_path_depth());
+		ImGui::Text("Intersection/shading = %.1f %% / %.1f %%", 100.0f * stats.intersect_fraction(), 100.0f * (1.0f - stats.intersect_fraction()));
+
+		static const char * shader_names[SHADER_COUNT] = { "-", "normal", "lambert", "phong", "glass", "pathtracer", "mirror", "clear glass" };
+		for (int i = 1; i < SHADER_COUNT; ++i)
+		{
+			if (stats.totals.hits[i] > 0)
+			{
+				ImGui::Text("%s hits = %I64u", shader_names[i], stats.totals.hits[i]);
+			}
+		}
+
+		bool log_stats = log_stats_.load(std::memory_order_relaxed);
+		if (ImGui::Checkbox("Log to ray_stats.jsonl", &log_stats))
+		{
+			log_stats_.store(log_stats, std::memory_order_relaxed);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Surfaces"))
+	{
+		std::vector<std::pair<std::string, bool>> visibility;
+		std::vector<Vector3> motions;
+		std::vector<bool> merged;
+		{
+			std::lock_guard<std::mutex> lock(objects_lock_);
+			for (const auto & object : objects_)
+			{
+				visibility.push_back(std::make_pair(object.removed ? std::string() : object.surface->get_name(), object.visible));
+				motions.push_back(object.motion);
+				merged.push_back(object.merged);
+			}
+		} // lock release
+
+		for (int i = 0; i < static_cast<int>(visibility.size()); ++i)
+		{
+			if (visibility[i].first.empty())
+			{
+				continue;
+			}
+
+			ImGui::PushID(i);
+			if (merged[i])
+			{
+				// part of a merged geometry, it cannot be edited
+				ImGui::TextDisabled("%s", visibility[i].first.c_str());
+			}
+			else
+			{
+				if (ImGui::Checkbox(visibility[i].first.c_str(), &visibility[i].second))
+				{
+					SetSurfaceVisible(i, visibility[i].second);
+				}
+				ImGui::SameLine();
+				ImGui::PushItemWidth(150.0f);
+				if (ImGui::DragFloat3("Motion", &motions[i].x, 0.5f))
+				{
+					SetSurfaceMotion(i, motions[i]);
+				}
+				ImGui::PopItemWidth();
+			}
+			ImGui::PopID();
+		}
+	}
+
 	//ImGui::Checkbox( "Demo Window", &show_demo_window );      // Edit bools storing our window open/close state
 	//ImGui::Checkbox( "Another Window", &show_another_window );
 
@@ -533,6 +1899,31 @@ int Raytracer::Ui()
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 	ImGui::End();
 
+	// camera control, arrows move and WASD rotate the view
+	if (!ImGui::GetIO().WantCaptureKeyboard)
+	{
+		const float step = camera_speed_ * ImGui::GetIO().DeltaTime * 60.0f;
+		const float angle = deg2rad(step);
+
+		std::lock_guard<std::mutex> lock(camera_lock_);
+		Camera camera = pending_camera_;
+
+		if (GetKeyState(VK_UP) & 0x8000) camera.MoveForward(step);
+		if (GetKeyState(VK_DOWN) & 0x8000) camera.MoveForward(-step);
+		if (GetKeyState(VK_RIGHT) & 0x8000) camera.MoveRight(step);
+		if (GetKeyState(VK_LEFT) & 0x8000) camera.MoveRight(-step);
+		if (GetKeyState('D') & 0x8000) camera.RotateRight(angle);
+		if (GetKeyState('A') & 0x8000) camera.RotateRight(-angle);
+		if (GetKeyState('W') & 0x8000) camera.RotateUp(angle);
+		if (GetKeyState('S') & 0x8000) camera.RotateUp(-angle);
+
+		if (!camera.SameView(pending_camera_))
+		{
+			pending_camera_ = camera;
+			camera_dirty_ = true;
+		}
+	} // lock release
+
 	// 3. Show another simple window.
 	/*if ( show_another_window )
 	{
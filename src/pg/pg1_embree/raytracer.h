@@ -3,7 +3,15 @@
 #include "surface.h"
 #include "camera.h"
 #include "structs.h"
+#include "raystats.h"
 #include "Background.h"
+#include "denoiser.h"
+#include "tonemapper.h"
+#include "sequence.h"
+#include "shadowqueue.h"
+#include "lights.h"
+#include "materialtable.h"
+#include <deque>
 
 /*! \class Raytracer
 \brief General ray tracer class.
@@ -17,7 +25,7 @@ class Raytracer : public SimpleGuiDX11
 public:
 	Raytracer( const int width, const int height, 
 		const float fov_y, const Vector3 view_from, const Vector3 view_at,
-		const char * config = "threads=0,verbose=3" );
+		const char * config = "threads=0,verbose=3", const SceneProfile profile = SceneProfile() );
 	~Raytracer();
 
 	int InitDeviceAndScene( const char * config );
@@ -26,26 +34,219 @@ public:
 
 	void LoadScene( const std::string file_name );
 
+	/* replaces the environment map before rendering, HDR images (.hdr, .exr, .pfm) keep their full dynamic range */
+	void LoadBackground( const std::string file_name );
+
+	/* loads a scene description (SCN) file whose prototypes are shared by instancing, see LoadSCN */
+	void LoadSceneDescription( const std::string file_name );
+
+	/* Runtime scene editing. Surfaces are referenced by handles returned from AddSurface (or assigned
+	in the load order by LoadScene). Edits are only recorded here and applied by Update between passes. */
+	int AddSurface( Surface * surface, const Matrix3x3 & linear = Matrix3x3(), const Vector3 & translation = Vector3() );
+	void RemoveSurface( const int handle );
+	void SetSurfaceTransform( const int handle, const Matrix3x3 & linear, const Vector3 & translation );
+	void SetSurfaceVisible( const int handle, const bool visible );
+	void SetSurfaceMaterial( const int handle, Material * material );
+	/* linear motion of the surface, it is displaced by motion at time 1 (the end of the frame) relative to time 0 */
+	void SetSurfaceMotion( const int handle, const Vector3 & motion );
+	/* notifies the renderer that properties of the material have been modified */
+	void InvalidateMaterial( const Material * material );
+	/* adds a point, spot or directional light, emissive surfaces are turned into area lights automatically */
+	void AddLight( const Light & light );
+
+	/* records a new view, it is used from the next pass on */
+	void SetCamera( const Camera & camera );
+
+	/*! \fn int RenderSequence( const Sequence & sequence )
+	\brief Renders the frames of the sequence headless and saves their accumulated images.
+	Moving surfaces only get their BVHs refitted between frames. Frame N is written by a
+	background thread while frame N + 1 is being rendered.
+	\return 0 if all frames were saved.
+	*/
+	int RenderSequence( const Sequence & sequence );
+
+	/* applies pending scene and camera edits, returns true when the accumulated image is no longer valid */
+	bool Update() override;
+
+	/* gathers ray statistics of the finished pass */
+	void EndPass( const float pass_time ) override;
+
+	/* shows the cost heatmap or the selected AOV, or denoises (if enabled) and tonemaps the accumulated image,
+	the saved image is the linear one then */
+	void Resolve( const float *& linear, const float *& display ) override;
+
+	PassStats last_stats();
+	double load_time() const;
+	double build_time() const;
+
 	Color4f get_pixel( const int x, const int y, const float t = 0.0f ) override;
 
-	Color4f trace_ray(RTCRayHitWithIor ray, int depth);
+	/* primary (if given) receives the distance, normal and albedo of the nearest hit, contributions
+	behind shadow rays are left out of the result if path has a shadow queue */
+	Color4f trace_ray(RTCRayHitWithIor ray, int depth, PrimaryHit * primary = nullptr, const PathState & path = PathState());
 
-	float trace_shadow_ray(const Vector3 & p, const Vector3 & l_d, const float dist, RTCIntersectContext context);
+	/* color of an escaped ray in the direction dir */
+	Color4f GetBackground(const Vector3 & dir) const;
+
+	float trace_shadow_ray(const Vector3 & p, const Vector3 & l_d, const float dist, RTCIntersectContext context, const float time = 0.0f);
+	/* picks one of the scene lights by its importance for the point p with the normal n and samples it */
+	bool SampleLight(const Vector3 & p, const Vector3 & n, LightSample & sample) const;
+	/* contribution if the shadow ray is unoccluded, or zero after queueing it weighted by the throughput if path has a shadow queue */
+	Color4f ShadowedContribution(const Vector3 & p, const Vector3 & l_d, const float dist, const float time,
+		const Color4f & contribution, const PathState & path);
+	/* one light sampled at the hit of the ray (p, shading normal n, geometric normal ng), its cosine weighted radiance
+	times brdf, behind a shadow ray */
+	Color4f DirectLight(const RTCRay & ray, const Vector3 & p, const Vector3 & n, const Vector3 & ng, const Vector3 & brdf,
+		const PathState & path);
 	float linearToSrgb(float color);
 	float getGeometryTerm(Vector3 omegaI, RTCIntersectContext context, Vector3 vectorToLight, Vector3 intersectionPoint, Vector3 normal);
 	float  castShadowRay(RTCIntersectContext context, Vector3 vectorToLight, float dstToLight, Vector3 intersectionPoint, Vector3 normal);
 
-	Vector3 sampleHemisphere(Vector3 normal);
+	/* uniformly distributed direction in the hemisphere around the normal */
+	static Vector3 sampleHemisphere(const Vector3 & normal);
 
 	Vector3 getInterpolatedPoint(RTCRay ray);
+	/* origin of a ray leaving the hit of ray in the direction dir, safely off the surface of the unit geometric normal ng, so tnear can be 0 */
+	Vector3 SpawnPoint(const RTCRay & ray, const Vector3 & ng, const Vector3 & dir);
 	int Ui();
 
 private:
+	/* primary rays of a span of pixels and their results, one per render thread */
+	struct Span
+	{
+		CameraRays rays;
+		std::vector<Color4f> colors; // of the rays
+		ShadowQueue shadows;
+	};
+
+	/* traces the paths of all pixels of the span, resolves their shadow rays at once and writes the AOVs */
+	void RenderSpan( Span & span, const int x0, const int y );
+
+	/* builds a triangle geometry from the surface and attaches it to the given scene, returns its geomID */
+	unsigned int AttachSurface( RTCScene scene, Surface * surface );
+	/* merges the surfaces into a single geometry with per-triangle material IDs, returns its geomID */
+	unsigned int AttachSurfaces( RTCScene scene, Surface * const * surfaces, const int no_surfaces );
+	/* zeroed material ID array of a new geometry of no_triangles, reuses a released one if possible */
+	unsigned int * AllocateMaterialIndices( const int no_triangles );
+	/* frees the material ID array (user data) of the geometry, before the geometry is detached */
+	void ReleaseMaterialIndices( RTCGeometry mesh );
+	/* places the committed prototype scene into scene_, returns the geomID of the instance */
+	unsigned int AttachInstance( RTCScene prototype, const Matrix3x3 & linear, const Vector3 & translation );
+
+	/* geometry of the hit, possibly inside an instanced prototype */
+	RTCGeometry GetHitGeometry( const RTCHit & hit ) const;
+	/* transforms the interpolated normal of an instanced hit from object to world space */
+	void ToWorldNormal( const RTCHit & hit, Normal3f & normal ) const;
+
+	struct InstanceRecord
+	{
+		RTCScene scene{ nullptr }; // instanced prototype
+		Matrix3x3 normal_matrix; // inverse transpose of the linear part of the instance transform
+	};
+
+	enum DirtyFlags { DIRTY_ADDED = 1, DIRTY_REMOVED = 2, DIRTY_TRANSFORM = 4, DIRTY_VISIBILITY = 8, DIRTY_MATERIAL = 16 };
+
+	/* editable surface attached directly to scene_ */
+	struct SceneObject
+	{
+		Surface * surface{ nullptr };
+		Material * material{ nullptr };
+		unsigned int geom_id{ RTC_INVALID_GEOMETRY_ID }; // invalid until the object is attached
+		Matrix3x3 linear; // object to world transform
+		Vector3 translation;
+		Vector3 motion; // displacement over the frame, non-zero adds a second time step to the geometry
+		int time_steps{ 1 }; // of the attached geometry
+		bool visible{ true };
+		bool removed{ false };
+		bool merged{ false }; // shares a static geometry with other surfaces, edits are ignored
+		int dirty{ 0 }; // combination of DirtyFlags
+	};
+
+	int RegisterObject( Surface * surface, const unsigned int geom_id, const bool merged = false );
+	/* false (with a warning) if the object shares a merged geometry and so cannot be edited */
+	bool Editable( const int handle ) const;
+	void MarkDirty( const int handle, const int flags );
+	/* true if the material of the object is emissive, visible ones are in the light tree */
+	bool EmitsLight( const SceneObject & object ) const;
+	/* sets the material ID of all triangles of the attached object */
+	void SetObjectMaterial( const SceneObject & object );
+	/* rewrites vertex positions (of all time steps) and normals of the attached object from its surface,
+	returns true if the number of time steps has changed */
+	bool UpdateObjectBuffers( SceneObject & object );
+	/* applies the dirty set, returns true when the visible scene has changed */
+	bool UpdateScene();
+	/* rebuilds light_tree_ from the added lights and the triangles of visible emissive objects,
+	returns false (and keeps the tree) if the emitters have not changed */
+	bool BuildLights();
+
+	/* reuses the accumulated samples of the previous view by forward projection of the primary hits,
+	returns false and leaves the image as it is if the depth of the hits is not available or the camera has a lens */
+	bool Reproject( const Camera & from, const Camera & to );
+
 	std::vector<Surface *> surfaces_;
 	std::vector<Material *> materials_;
+	MaterialTable material_table_; // compiled materials_ (and materials of added surfaces)
+	std::deque<std::vector<unsigned int>> material_indices_; // material ID of each triangle, one array per geometry (its user data)
+	std::vector<size_t> free_material_indices_; // slots of material_indices_ released by removed geometries
 
 	RTCDevice device_;
 	RTCScene scene_;
-	Camera camera_;
+	SceneProfile profile_; // BVH build settings
+	double load_time_{ 0.0 }; // time spent in LoadOBJ (s)
+	double build_time_{ 0.0 }; // time spent in rtcCommitScene (s)
+
+	std::vector<RTCScene> prototypes_; // committed prototype scenes
+	std::vector<InstanceRecord> instances_; // indexed by geomID of the instance in scene_
+
+	std::vector<SceneObject> objects_; // indexed by handle
+	std::vector<int> dirty_objects_; // handles of objects with pending edits
+	bool materials_dirty_{ false }; // a material of a visible object was modified
+	std::vector<Light> scene_lights_; // lights given by AddLight
+	bool lights_dirty_{ true }; // light_tree_ may not match the lights and the objects
+	std::vector<Light> built_lights_; // emitters light_tree_ was built from
+	LightTree light_tree_; // owned by the producer thread, sampled by the shaders
+	std::mutex objects_lock_; // guards objects_, scene_lights_ and the dirty set
+	Camera camera_; // view of the current pass, owned by the producer thread
+	Camera pending_camera_; // last view set by SetCamera
+	bool camera_dirty_{ false };
+	std::mutex camera_lock_; // guards pending_camera_ and camera_dirty_
+	std::atomic<bool> reprojection_{ false }; // reproject the accumulated image instead of a restart on camera changes
+	int reprojection_history_{ 4 }; // max. number of samples carried over by a reprojected pixel
+	AovHandle depth_aov_; // distance of the last primary hit of each pixel (FLT_MAX on miss)
+	AovHandle normal_aov_; // running mean of the primary hit normal
+	AovHandle albedo_aov_; // running mean of the primary hit albedo
+	AovHandle material_id_aov_; // ID in material_table_ of the last primary hit
+	AovHandle geometry_id_aov_; // geomID (or instID) in scene_ of the last primary hit
+	AovHandle cost_aov_; // TSC ticks spent in trace_ray per sample
+	AovHandle ray_count_aov_; // rays of all types traced per sample
+
+	enum HeatmapMode { HEATMAP_OFF = 0, HEATMAP_CYCLES = 1, HEATMAP_RAYS = 2 };
+	std::atomic<int> heatmap_{ HEATMAP_OFF }; // cost shown in place of the beauty image
+	std::atomic<float> heatmap_top_{ 0.0f }; // cost mapped to the top of the heatmap ramp
+	std::atomic<int> display_aov_{ 0 }; // AOV shown instead of the beauty image (0 is the beauty itself)
+	std::atomic<bool> denoise_{ false }; // filter the image before display and export
+	DenoiserSettings denoiser_settings_; // of the current resolve, owned by the producer thread
+	Denoiser denoiser_;
+	TonemapSettings tonemap_settings_; // of the current resolve, owned by the producer thread
+	Tonemapper tonemapper_;
+	DenoiserSettings pending_denoiser_settings_; // last settings from the user interface
+	TonemapSettings pending_tonemap_settings_;
+	bool display_settings_dirty_{ false };
+	std::mutex display_settings_lock_; // guards the pending settings and display_settings_dirty_
+	std::vector<float> display_; // tonemapped beauty or the visualized AOV, RGBA per pixel
+	std::vector<float> denoised_; // linear denoised beauty, RGBA per pixel
+	float camera_speed_{ 1.0f }; // world units per frame at 60 FPS
+	std::atomic<bool> env_sampling_{ true }; // importance sampling of the background in the path tracer
+	std::atomic<bool> fresnel_sampling_{ false }; // glass follows one Fresnel-weighted branch instead of both
+	std::atomic<bool> deferred_shadows_{ true }; // shadow rays of a span are traced together by rtcOccluded1M
+	char output_file_[256] = "output.pfm";
+	float image_save_interval_{ 0.0f }; // (s), 0 means no periodic image saves
+	char checkpoint_file_name_[256] = "render.ckpt";
+	float checkpoint_period_{ 0.0f }; // (s), 0 means no periodic checkpoints
+
+	PassStats last_stats_; // statistics of the last finished pass
+	std::mutex stats_lock_; // guards last_stats_
+	std::atomic<bool> log_stats_{ false }; // append statistics of every pass to stats_file_
+	std::string stats_file_{ "ray_stats.jsonl" }; // one JSON object per line
 	Background background_;
 };
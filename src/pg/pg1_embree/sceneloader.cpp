@@ -0,0 +1,169 @@
+/*! \file sceneloader.cpp
+\brief Loading of scene description (SCN) files which place OBJ prototypes by instancing.
+*/
+
+#include "stdafx.h"
+#include "sceneloader.h"
+#include "mymath.h"
+#include "utils.h"
+
+Matrix3x3 RotationXYZ( const float rx, const float ry, const float rz )
+{
+	const float cx = cosf( rx ), sx = sinf( rx );
+	const float cy = cosf( ry ), sy = sinf( ry );
+	const float cz = cosf( rz ), sz = sinf( rz );
+
+	const Matrix3x3 m_x( 1.0f, 0.0f, 0.0f,
+		0.0f, cx, -sx,
+		0.0f, sx, cx );
+	const Matrix3x3 m_y( cy, 0.0f, sy,
+		0.0f, 1.0f, 0.0f,
+		-sy, 0.0f, cy );
+	const Matrix3x3 m_z( cz, -sz, 0.0f,
+		sz, cz, 0.0f,
+		0.0f, 0.0f, 1.0f );
+
+	return m_z * ( m_y * m_x );
+}
+
+int LoadSCN( const char * file_name, SceneDescription & description )
+{
+	FILE * file = fopen( file_name, "rt" );
+	if ( file == NULL )
+	{
+		printf( "File %s not found.\n", file_name );
+
+		return -1;
+	}
+
+	// path to the given file, all referenced files are relative to it
+	std::string path;
+	const char * tmp = strrchr( file_name, '/' );
+	if ( tmp != NULL )
+	{
+		path = std::string( file_name, tmp - file_name + 1 );
+	}
+
+	printf( "Loading scene description from '%s'...\n", file_name );
+
+	char buffer[512] = { 0 };
+	char name[128] = { 0 };
+	char obj_file[256] = { 0 };
+	int line_no = 0;
+
+	while ( fgets( buffer, sizeof( buffer ), file ) != NULL )
+	{
+		++line_no;
+		char * line = buffer;
+		while ( isspace( *line ) )
+		{
+			++line;
+		}
+
+		if ( line[0] == '#' || line[0] == 0 )
+		{
+			continue;
+		}
+
+		RTrim( line );
+
+		if ( strstr( line, "mesh" ) == line )
+		{
+			if ( sscanf( line, "%*s %255s", obj_file ) == 1 )
+			{
+				description.meshes.push_back( path + obj_file );
+				continue;
+			}
+		}
+		else if ( strstr( line, "prototype" ) == line )
+		{
+			if ( sscanf( line, "%*s %127s %255s", name, obj_file ) == 2 )
+			{
+				description.prototypes.push_back( std::make_pair( std::string( name ), path + obj_file ) );
+				continue;
+			}
+		}
+		else if ( strstr( line, "instance" ) == line )
+		{
+			Placement placement;
+			float r[3] = { 0.0f, 0.0f, 0.0f };
+			float scale = 1.0f;
+
+			const int no_items = sscanf( line, "%*s %127s %f %f %f %f %f %f %f", name,
+				&placement.translation.x, &placement.translation.y, &placement.translation.z,
+				&r[0], &r[1], &r[2], &scale );
+
+			if ( no_items >= 4 )
+			{
+				placement.prototype = name;
+				placement.linear = RotationXYZ( deg2rad( r[0] ), deg2rad( r[1] ), deg2rad( r[2] ) ) *
+					Matrix3x3( scale, 0.0f, 0.0f, 0.0f, scale, 0.0f, 0.0f, 0.0f, scale );
+				description.instances.push_back( placement );
+				continue;
+			}
+		}
+		else if ( strstr( line, "matrix" ) == line )
+		{
+			Placement placement;
+			float m[9];
+
+			if ( sscanf( line, "%*s %127s %f %f %f %f %f %f %f %f %f %f %f %f", name,
+				&m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &m[6], &m[7], &m[8],
+				&placement.translation.x, &placement.translation.y, &placement.translation.z ) == 13 )
+			{
+				placement.prototype = name;
+				placement.linear = Matrix3x3( m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8] );
+				description.instances.push_back( placement );
+				continue;
+			}
+		}
+		else if ( strstr( line, "light" ) == line )
+		{
+			Light light;
+			char type[32] = { 0 };
+			float v[11];
+			const int no_items = sscanf( line, "%*s %31s %f %f %f %f %f %f %f %f %f %f %f", type,
+				&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10] );
+
+			if ( strcmp( type, "point" ) == 0 && no_items == 7 )
+			{
+				light.type = LIGHT_POINT;
+				light.position = Vector3( v[0], v[1], v[2] );
+				light.color = Vector3( v[3], v[4], v[5] );
+				description.lights.push_back( light );
+				continue;
+			}
+			else if ( strcmp( type, "spot" ) == 0 && no_items == 12 )
+			{
+				light.type = LIGHT_SPOT;
+				light.position = Vector3( v[0], v[1], v[2] );
+				light.direction = Vector3( v[3], v[4], v[5] );
+				light.direction.Normalize();
+				light.color = Vector3( v[6], v[7], v[8] );
+				light.cos_inner = cosf( deg2rad( v[9] ) );
+				light.cos_outer = cosf( deg2rad( v[10] ) );
+				description.lights.push_back( light );
+				continue;
+			}
+			else if ( strcmp( type, "directional" ) == 0 && no_items == 7 )
+			{
+				light.type = LIGHT_DIRECTIONAL;
+				light.direction = Vector3( v[0], v[1], v[2] );
+				light.direction.Normalize();
+				light.color = Vector3( v[3], v[4], v[5] );
+				description.lights.push_back( light );
+				continue;
+			}
+		}
+
+		printf( "Skipping malformed line %d: %s\n", line_no, line );
+	}
+
+	fclose( file );
+	file = NULL;
+
+	printf( "%I64u prototype(s), %I64u mesh(es), %I64u instance(s) and %I64u light(s).\nDone.\n\n",
+		description.prototypes.size(), description.meshes.size(), description.instances.size(), description.lights.size() );
+
+	return static_cast<int>( description.instances.size() );
+}
@@ -0,0 +1,56 @@
+#ifndef SCENE_LOADER_H_
+#define SCENE_LOADER_H_
+
+#include "vector3.h"
+#include "matrix3x3.h"
+#include "lights.h"
+
+/*! \struct Placement
+\brief Single placement of a prototype mesh, p_world = linear * p_object + translation.
+*/
+struct Placement
+{
+	std::string prototype; // name of the placed prototype
+	Matrix3x3 linear; // rotation and scale
+	Vector3 translation;
+};
+
+/*! \struct SceneDescription
+\brief Content of a scene description (SCN) file.
+*/
+struct SceneDescription
+{
+	std::vector<std::pair<std::string, std::string>> prototypes; // prototype name and full path of its OBJ file
+	std::vector<std::string> meshes; // full paths of OBJ files attached directly to the top-level scene
+	std::vector<Placement> instances;
+	std::vector<Light> lights; // point, spot and directional lights, area lights come from emissive materials
+};
+
+/*! \fn int LoadSCN( const char * file_name, SceneDescription & description )
+\brief Loads a scene description from the text file \a file_name.
+
+Each line holds one command, lines starting with # are ignored.
+File names are relative to the directory of the SCN file.
+
+\code
+mesh <obj file>
+prototype <name> <obj file>
+instance <name> <tx> <ty> <tz> [<rx> <ry> <rz> [<scale>]]
+matrix <name> <m00> <m01> <m02> <m10> <m11> <m12> <m20> <m21> <m22> <tx> <ty> <tz>
+light point <x> <y> <z> <r> <g> <b>
+light spot <x> <y> <z> <dx> <dy> <dz> <r> <g> <b> <inner angle> <outer angle>
+light directional <dx> <dy> <dz> <r> <g> <b>
+\endcode
+
+Rotations of the instance command are in degrees and applied in the x, y, z order.
+Colors of point and spot lights are their intensities, the one of a directional light is
+its irradiance. Spot cone angles are measured from the axis in degrees. Directions of
+spot and directional lights point where the light travels.
+
+\param file_name full path to the SCN file.
+\param description parsed scene description.
+\return Number of instances or -1 when the file cannot be read.
+*/
+int LoadSCN( const char * file_name, SceneDescription & description );
+
+#endif
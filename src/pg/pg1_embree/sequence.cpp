@@ -0,0 +1,97 @@
+#include "stdafx.h"
+#include "sequence.h"
+
+namespace
+{
+	/* index i and weight t of the key pair ( i, i + 1 ) bracketing the time, t = 0 for a single key */
+	template<typename Key>
+	void FindSegment( const std::vector<Key> & keys, const float time, int & i, float & t )
+	{
+		i = 0;
+		t = 0.0f;
+
+		if ( keys.size() < 2 || time <= keys.front().time )
+		{
+			return;
+		}
+
+		if ( time >= keys.back().time )
+		{
+			i = static_cast<int>( keys.size() ) - 2;
+			t = 1.0f;
+			return;
+		}
+
+		while ( keys[i + 1].time < time )
+		{
+			++i;
+		}
+
+		const float span = keys[i + 1].time - keys[i].time;
+		t = ( span > 0.0f ) ? ( time - keys[i].time ) / span : 1.0f;
+	}
+
+	Vector3 Lerp( const Vector3 & a, const Vector3 & b, const float t )
+	{
+		return a + t * ( b - a );
+	}
+}
+
+bool Sequence::CameraAt( const float time, Vector3 & view_from, Vector3 & view_at ) const
+{
+	if ( camera.empty() )
+	{
+		return false;
+	}
+
+	int i;
+	float t;
+	FindSegment( camera, time, i, t );
+
+	if ( camera.size() == 1 )
+	{
+		view_from = camera[0].view_from;
+		view_at = camera[0].view_at;
+	}
+	else
+	{
+		view_from = Lerp( camera[i].view_from, camera[i + 1].view_from, t );
+		view_at = Lerp( camera[i].view_at, camera[i + 1].view_at, t );
+	}
+
+	return true;
+}
+
+bool Sequence::TransformAt( const TransformTrack & track, const float time, Matrix3x3 & linear, Vector3 & translation )
+{
+	const std::vector<TransformKey> & keys = track.keys;
+
+	if ( keys.empty() )
+	{
+		return false;
+	}
+
+	if ( keys.size() == 1 )
+	{
+		linear = keys[0].linear;
+		translation = keys[0].translation;
+
+		return true;
+	}
+
+	int i;
+	float t;
+	FindSegment( keys, time, i, t );
+
+	for ( int row = 0; row < 3; ++row )
+	{
+		for ( int column = 0; column < 3; ++column )
+		{
+			const float a = keys[i].linear.get( row, column );
+			linear.set( row, column, a + t * ( keys[i + 1].linear.get( row, column ) - a ) );
+		}
+	}
+	translation = Lerp( keys[i].translation, keys[i + 1].translation, t );
+
+	return true;
+}
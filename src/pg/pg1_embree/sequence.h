@@ -0,0 +1,55 @@
+#ifndef SEQUENCE_H_
+#define SEQUENCE_H_
+
+#include "vector3.h"
+#include "matrix3x3.h"
+
+/* view of the camera at the given time (s) */
+struct CameraKey
+{
+	float time;
+	Vector3 view_from;
+	Vector3 view_at;
+};
+
+/* object to world transform of a surface at the given time (s) */
+struct TransformKey
+{
+	float time;
+	Matrix3x3 linear;
+	Vector3 translation;
+};
+
+/* keys of one editable surface, see Raytracer::SetSurfaceTransform */
+struct TransformTrack
+{
+	int handle;
+	std::vector<TransformKey> keys; // sorted by time
+};
+
+/*! \struct Sequence
+\brief Keyframed camera and surface transforms rendered frame by frame (see Raytracer::RenderSequence).
+
+Keys are interpolated linearly and held constant before the first and after the last key.
+The linear parts of transforms are blended element-wise, which is fine for the small
+rotations between keys but does not preserve lengths of large ones.
+*/
+struct Sequence
+{
+	std::vector<CameraKey> camera; // sorted by time, empty keeps the current view
+	std::vector<TransformTrack> transforms;
+
+	int first_frame{ 0 };
+	int last_frame{ 0 }; // inclusive
+	float fps{ 24.0f }; // frame f shows the time f / fps
+	int spp{ 64 }; // passes per frame
+	std::string output_pattern{ "frame_%04d.exr" }; // printf pattern of the frame number, PFM or EXR
+	bool motion_blur{ false }; // moving surfaces get the motion to the next frame, needs an open camera shutter
+
+	/* interpolated view, returns false if there are no camera keys */
+	bool CameraAt( const float time, Vector3 & view_from, Vector3 & view_at ) const;
+	/* interpolated transform of the track, returns false if the track has no keys */
+	static bool TransformAt( const TransformTrack & track, const float time, Matrix3x3 & linear, Vector3 & translation );
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include "stdafx.h"
+#include "shadowqueue.h"
+#include "raystats.h"
+
+void ShadowQueue::Push( const Vector3 & origin, const Vector3 & dir, const float tnear, const float tfar, const float time,
+	const Color4f & contribution, const int pixel )
+{
+	RTCRay ray = RTCRay();
+	ray.org_x = origin.x;
+	ray.org_y = origin.y;
+	ray.org_z = origin.z;
+	ray.tnear = tnear;
+
+	ray.dir_x = dir.x;
+	ray.dir_y = dir.y;
+	ray.dir_z = dir.z;
+	ray.time = time;
+
+	ray.tfar = tfar;
+	ray.mask = 0;
+	ray.id = static_cast<unsigned int>( rays_.size() );
+	ray.flags = 0;
+
+	rays_.push_back( ray );
+	contributions_.push_back( contribution );
+	pixels_.push_back( pixel );
+
+	++ThreadRayStats().rays[RAY_SHADOW];
+}
+
+void ShadowQueue::Resolve( RTCScene scene, Color4f * colors )
+{
+	if ( rays_.empty() )
+	{
+		return;
+	}
+
+	// the rays of one span start from neighbouring hits, so Embree may trace them as a coherent stream
+	RTCIntersectContext context;
+	rtcInitIntersectContext( &context );
+	context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+	RayStats & stats = ThreadRayStats();
+	const unsigned long long t0 = __rdtsc();
+	rtcOccluded1M( scene, &context, rays_.data(), static_cast<unsigned int>( rays_.size() ), sizeof( RTCRay ) );
+	stats.intersect_ticks += __rdtsc() - t0;
+
+	// Embree sets tfar of the occluded rays to -inf
+	for ( size_t i = 0; i < rays_.size(); ++i )
+	{
+		if ( rays_[i].tfar >= 0.0f )
+		{
+			colors[pixels_[i]] += contributions_[i];
+		}
+	}
+
+	rays_.clear();
+	contributions_.clear();
+	pixels_.clear();
+}
+
+int ShadowQueue::size() const
+{
+	return static_cast<int>( rays_.size() );
+}
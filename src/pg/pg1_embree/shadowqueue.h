@@ -0,0 +1,50 @@
+#ifndef SHADOW_QUEUE_H_
+#define SHADOW_QUEUE_H_
+
+#include "vector3.h"
+#include "structs.h"
+
+/*! \class ShadowQueue
+\brief Deferred occlusion queries of the paths of one span of pixels.
+
+Shaders push a shadow ray together with the contribution it carries to its pixel
+(already weighted by the path throughput) instead of tracing it. Resolve then traces
+all queued rays by a single rtcOccluded1M call and adds the contributions of the
+unoccluded ones, so the traversal setup is shared by the whole stream.
+*/
+class ShadowQueue
+{
+public:
+	/* queues the segment origin + t * dir, t in <tnear, tfar>, which adds contribution to the pixel if it is unoccluded */
+	void Push( const Vector3 & origin, const Vector3 & dir, const float tnear, const float tfar, const float time,
+		const Color4f & contribution, const int pixel );
+
+	/* traces the queued rays, adds the visible contributions to colors (indexed by pixel) and empties the queue */
+	void Resolve( RTCScene scene, Color4f * colors );
+
+	int size() const;
+
+private:
+	std::vector<RTCRay> rays_;
+	std::vector<Color4f> contributions_;
+	std::vector<int> pixels_;
+};
+
+/* weight of the current path vertex in its pixel and the queue for its shadow rays */
+struct PathState
+{
+	Vector3 throughput{ Vector3( 1.0f, 1.0f, 1.0f ) };
+	ShadowQueue * shadows{ nullptr }; // shadow rays are traced immediately without a queue
+	int pixel{ 0 }; // index of the pixel within the span
+
+	/* state of the next vertex reached through a scattering event of the given weight */
+	PathState Scaled( const Vector3 & weight ) const
+	{
+		PathState state = *this;
+		state.throughput = throughput * weight;
+
+		return state;
+	}
+};
+
+#endif
@@ -1,12 +1,23 @@
 #include "stdafx.h"
 #include "simpleguidx11.h"
+#include "utils.h"
+#include "imageio.h"
 
-SimpleGuiDX11::SimpleGuiDX11( const int width, const int height)
+SimpleGuiDX11::SimpleGuiDX11( const int width, const int height) : aovs_( width, height )
 {
 	width_ = width;
 	height_ = height;
 
-	Init();
+	tex_data_ = new float[width_ * height_ * 4];
+	memset( tex_data_, 0, width_ * height_ * 4 * sizeof( float ) );
+	accumulator_ = new float[width_ * height_ * 4];
+	sample_counts_ = new int[width_ * height_];
+	ResetAccumulation();
+
+	aovs_.RegisterExternal( "beauty", AOV_FLOAT4, accumulator_ );
+	aovs_.RegisterExternal( "sample_count", AOV_UINT, sample_counts_ );
+
+	// the window is created by MainLoop, so the renderer can also run headless
 }
 
 int SimpleGuiDX11::Init()
@@ -45,7 +56,6 @@ int SimpleGuiDX11::Init()
 	ImGui::StyleColorsDark();
 	//ImGui::StyleColorsClassic();
 
-	tex_data_ = new float[width_ * height_ * 4 * sizeof( float )];	
 	CreateTexture();
 
 	return 0;
@@ -57,16 +67,28 @@ SimpleGuiDX11::~SimpleGuiDX11()
 	 
 	delete[] tex_data_;
 	tex_data_ = nullptr;
+
+	delete[] accumulator_;
+	accumulator_ = nullptr;
+
+	delete[] sample_counts_;
+	sample_counts_ = nullptr;
 }
 
 int SimpleGuiDX11::Cleanup()
 {
+	if ( hwnd_ == nullptr )
+	{
+		return 0; // no window has been created
+	}
+
 	ImGui_ImplDX11_Shutdown();
 	ImGui_ImplWin32_Shutdown();
 	ImGui::DestroyContext();
 
 	CleanupDeviceD3D();
 	DestroyWindow( hwnd_ );
+	hwnd_ = nullptr;
 	UnregisterClass( _T( "ImGui Example" ), wc_.hInstance );
 
 	return 0;
@@ -83,52 +105,117 @@ Color4f SimpleGuiDX11::get_pixel( const int x, const int y, const float t )
 	return Color4f{ 1.0f, 0.0f, 1.0f, 1.0f };
 }
 
-void SimpleGuiDX11::Producer()
+// abstract method reimplemented in the descendant
+bool SimpleGuiDX11::Update()
+{
+	return false;
+}
+
+void SimpleGuiDX11::EndPass( const float pass_time )
+{
+}
+
+void SimpleGuiDX11::Resolve( const float *& linear, const float *& display )
+{
+	linear = accumulator_;
+	display = accumulator_;
+}
+
+void SimpleGuiDX11::ResetAccumulation()
 {
-	float * local_data = new float[width_*height_ * 4];
+	memset( accumulator_, 0, width_ * height_ * 4 * sizeof( float ) );
+	memset( sample_counts_, 0, width_ * height_ * sizeof( int ) );
+	aovs_.Clear();
+}
+
+void SimpleGuiDX11::RenderPass( const float t )
+{
+	// apply pending changes and start over if the image is no longer valid
+	const bool aovs_enabled = aovs_.Apply();
+	if ( Update() || aovs_enabled )
+	{
+		ResetAccumulation();
+	}
+
+	// resume after the pending changes, so the restored image is not reset by them
+	std::string resume_file;
+	{
+		std::lock_guard<std::mutex> lock( save_lock_ );
+		resume_file.swap( resume_request_ );
+	} // lock release
+
+	if ( !resume_file.empty() )
+	{
+		LoadCheckpoint( resume_file );
+	}
+
+	// compute rendering
+	const auto pass_start = std::chrono::high_resolution_clock::now();
+	const unsigned int pass_seed = HashSeed( seed_, static_cast<unsigned int>( pass_ ) );
+
+#pragma omp parallel for schedule(dynamic,5)
+	for (int y = 0; y < height_; ++y)
+	{
+		// seeding per row keeps the image independent of the thread scheduling
+		SeedRandom( HashSeed( pass_seed, y ) );
+
+		for (int x = 0; x < width_; ++x)
+		{
+			const Color4f pixel = get_pixel(x, y, t);
+			const int offset = (y * width_ + x) * 4;
+
+			// every pixel keeps its own count, reprojected history may start a pixel at n > 0
+			const int n = sample_counts_[y * width_ + x]++;
+
+			//pathtracer
+			accumulator_[offset] = ((accumulator_[offset] * n) + pixel.r) / (n + 1);
+			accumulator_[offset + 1] = ((accumulator_[offset + 1] * n) + pixel.g) / (n + 1);
+			accumulator_[offset + 2] = ((accumulator_[offset + 2] * n) + pixel.b) / (n + 1);
+			accumulator_[offset + 3] = 1.0f;
 
+			//pixel.copy( accumulator_[offset] );
+		}
+	}
+	++pass_;
+
+	const std::chrono::duration<float> pass_duration = std::chrono::high_resolution_clock::now() - pass_start;
+	pass_time_.store( pass_duration.count(), std::memory_order_relaxed );
+	EndPass( pass_duration.count() );
+}
+
+void SimpleGuiDX11::Producer()
+{
 	float t = 0.0f; // time
 	auto t0 = std::chrono::high_resolution_clock::now();
 
 	// refinenment loop
 	//for ( float t = 0.0f; t < 1e+3 && !finish_request_.load( std::memory_order_acquire ); t += float( 1e-1 ) )
-	int n = 0;
 	while (!finish_request_.load(std::memory_order_acquire))
 	{
 		auto t1 = std::chrono::high_resolution_clock::now();
 		std::chrono::duration<float> dt = t1 - t0;
 		t += dt.count();
 		t0 = t1;
-		// compute rendering
-		//std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
-#pragma omp parallel for schedule(dynamic,5)
-		for (int y = 0; y < height_; ++y)
-		{
-			for (int x = 0; x < width_; ++x)
-			{
-				const Color4f pixel = get_pixel(x, y, t);
-				const int offset = (y * width_ + x) * 4;
-
 
-				//pathtracer
-				local_data[offset] = ((local_data[offset] * n) + pixel.r) / (n + 1);
-				local_data[offset + 1] = ((local_data[offset + 1] * n) + pixel.g) / (n + 1);
-				local_data[offset + 2] = ((local_data[offset + 2] * n) + pixel.b) / (n + 1);
-				local_data[offset + 3] = 1.0f;
-
-				//pixel.copy( local_data[offset] );
-			}
-		}
-		n++;
+		//std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+		RenderPass( t );
+		const float * linear = nullptr;
+		const float * display = nullptr;
+		Resolve( linear, display );
+		SaveOutputs( linear );
 
 		// write rendering results
 		{
 			std::lock_guard<std::mutex> lock(tex_data_lock_);
-			memcpy(tex_data_, local_data, width_ * height_ * 4 * sizeof(float));
+			memcpy(tex_data_, display, width_ * height_ * 4 * sizeof(float));
 		} // lock release
 	}
 
-	delete[] local_data;
+	// do not leave a truncated checkpoint behind
+	if ( checkpoint_writer_.valid() )
+	{
+		checkpoint_writer_.wait();
+	}
 }
 
 int SimpleGuiDX11::width() const
@@ -141,8 +228,209 @@ int SimpleGuiDX11::height() const
 	return height_;
 }
 
+void SimpleGuiDX11::SetSeed( const unsigned int seed )
+{
+	seed_ = seed;
+}
+
+const float * SimpleGuiDX11::image() const
+{
+	return accumulator_;
+}
+
+int SimpleGuiDX11::SaveImage( const std::string & file_name ) const
+{
+	return ::SaveImage( file_name, accumulator_, width_, height_ );
+}
+
+void SimpleGuiDX11::RequestSave( const std::string & file_name )
+{
+	std::lock_guard<std::mutex> lock( save_lock_ );
+	save_requests_.push_back( file_name );
+}
+
+void SimpleGuiDX11::RequestSaveAovs( const std::string & file_name )
+{
+	std::lock_guard<std::mutex> lock( save_lock_ );
+	aov_save_requests_.push_back( file_name );
+}
+
+void SimpleGuiDX11::SetAutoSave( const std::string & file_name, const float interval )
+{
+	std::lock_guard<std::mutex> lock( save_lock_ );
+	auto_save_file_ = file_name;
+	auto_save_interval_ = interval;
+	last_auto_save_ = std::chrono::high_resolution_clock::now();
+}
+
+void SimpleGuiDX11::SaveOutputs( const float * image )
+{
+	std::vector<std::string> files;
+	std::vector<std::string> aov_files;
+	{
+		std::lock_guard<std::mutex> lock( save_lock_ );
+		files.swap( save_requests_ );
+		aov_files.swap( aov_save_requests_ );
+
+		const auto now = std::chrono::high_resolution_clock::now();
+		if ( auto_save_interval_ > 0.0f &&
+			std::chrono::duration<float>( now - last_auto_save_ ).count() >= auto_save_interval_ )
+		{
+			files.push_back( auto_save_file_ );
+			last_auto_save_ = now;
+		}
+	} // lock release
+
+	for ( const auto & file_name : files )
+	{
+		if ( ::SaveImage( file_name, image, width_, height_ ) == 0 )
+		{
+			printf( "Image saved to %s (%d passes).\n", file_name.c_str(), pass_ );
+		}
+	}
+
+	for ( const auto & file_name : aov_files )
+	{
+		const size_t dot = file_name.find_last_of( '.' );
+		aovs_.SaveAll( file_name.substr( 0, dot ), ( dot != std::string::npos ) ? file_name.substr( dot + 1 ) : "pfm" );
+	}
+
+	std::string checkpoint_file;
+	{
+		std::lock_guard<std::mutex> lock( save_lock_ );
+
+		const auto now = std::chrono::high_resolution_clock::now();
+		if ( checkpoint_interval_ > 0.0f &&
+			std::chrono::duration<float>( now - last_checkpoint_ ).count() >= checkpoint_interval_ )
+		{
+			checkpoint_file = checkpoint_file_;
+			last_checkpoint_ = now;
+		}
+	} // lock release
+
+	// skip this checkpoint if the previous one is still being written
+	if ( checkpoint_file.empty() || ( checkpoint_writer_.valid() &&
+		checkpoint_writer_.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready ) )
+	{
+		return;
+	}
+
+	// the render continues on the buffers while the snapshot is written in the background
+	checkpoint_colors_.assign( accumulator_, accumulator_ + width_ * height_ * 4 );
+	checkpoint_counts_.assign( sample_counts_, sample_counts_ + width_ * height_ );
+
+	CheckpointHeader header = { { 'P', 'G', 'C', 'K' }, 1, width_, height_, seed_, pass_ };
+
+	checkpoint_writer_ = std::async( std::launch::async, [this, header, checkpoint_file]() {
+		return WriteCheckpoint( checkpoint_file, header, checkpoint_colors_.data(), checkpoint_counts_.data(), checkpoint_counts_.size() );
+	} );
+}
+
+int SimpleGuiDX11::SaveCheckpoint( const std::string & file_name ) const
+{
+	const CheckpointHeader header = { { 'P', 'G', 'C', 'K' }, 1, width_, height_, seed_, pass_ };
+
+	return WriteCheckpoint( file_name, header, accumulator_, sample_counts_, static_cast<size_t>( width_ ) * height_ );
+}
+
+int SimpleGuiDX11::WriteCheckpoint( const std::string & file_name, const CheckpointHeader & header,
+	const float * colors, const int * counts, const size_t no_pixels )
+{
+	// write to a temporary file first, so an interruption keeps the previous checkpoint intact
+	const std::string tmp_file = file_name + ".tmp";
+	FILE * file = fopen( tmp_file.c_str(), "wb" );
+	if ( file == NULL )
+	{
+		printf( "Unable to write checkpoint %s.\n", file_name.c_str() );
+
+		return -1;
+	}
+
+	bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+	ok = ok && fwrite( colors, sizeof( float ), no_pixels * 4, file ) == no_pixels * 4;
+	ok = ok && fwrite( counts, sizeof( int ), no_pixels, file ) == no_pixels;
+	ok = ( fclose( file ) == 0 ) && ok;
+	file = NULL;
+
+	if ( !ok || !MoveFileExA( tmp_file.c_str(), file_name.c_str(), MOVEFILE_REPLACE_EXISTING ) )
+	{
+		printf( "Unable to write checkpoint %s.\n", file_name.c_str() );
+		DeleteFileA( tmp_file.c_str() );
+
+		return -1;
+	}
+
+	return 0;
+}
+
+int SimpleGuiDX11::LoadCheckpoint( const std::string & file_name )
+{
+	FILE * file = fopen( file_name.c_str(), "rb" );
+	if ( file == NULL )
+	{
+		printf( "Checkpoint %s not found.\n", file_name.c_str() );
+
+		return -1;
+	}
+
+	CheckpointHeader header;
+	if ( fread( &header, sizeof( header ), 1, file ) != 1 || strncmp( header.magic, "PGCK", 4 ) != 0 ||
+		header.version != 1 || header.width != width_ || header.height != height_ )
+	{
+		printf( "Checkpoint %s does not match the %dx%d renderer.\n", file_name.c_str(), width_, height_ );
+		fclose( file );
+
+		return -1;
+	}
+
+	const size_t no_pixels = static_cast<size_t>( width_ ) * height_;
+	if ( fread( accumulator_, sizeof( float ), no_pixels * 4, file ) != no_pixels * 4 ||
+		fread( sample_counts_, sizeof( int ), no_pixels, file ) != no_pixels )
+	{
+		printf( "Checkpoint %s is truncated.\n", file_name.c_str() );
+		fclose( file );
+		ResetAccumulation();
+
+		return -1;
+	}
+
+	fclose( file );
+	file = NULL;
+
+	// the passes continue with the random streams following the saved ones
+	seed_ = header.seed;
+	pass_ = header.pass;
+
+	// guides and IDs of the previous render do not belong to the restored image, the averages
+	// restart with the next sample of each pixel and the rest is rewritten by the next pass
+	aovs_.Clear();
+
+	printf( "Resumed from %s after %d passes.\n", file_name.c_str(), pass_ );
+
+	return 0;
+}
+
+void SimpleGuiDX11::RequestResume( const std::string & file_name )
+{
+	std::lock_guard<std::mutex> lock( save_lock_ );
+	resume_request_ = file_name;
+}
+
+void SimpleGuiDX11::SetCheckpointInterval( const std::string & file_name, const float interval )
+{
+	std::lock_guard<std::mutex> lock( save_lock_ );
+	checkpoint_file_ = file_name;
+	checkpoint_interval_ = interval;
+	last_checkpoint_ = std::chrono::high_resolution_clock::now();
+}
+
 int SimpleGuiDX11::MainLoop()
 {
+	if ( hwnd_ == nullptr )
+	{
+		Init();
+	}
+
 	// start image producing threads
 	std::thread producer_thread( &SimpleGuiDX11::Producer, this );
 	BOOL r = SetThreadPriority( producer_thread.native_handle(), THREAD_PRIORITY_BELOW_NORMAL );
@@ -1,6 +1,8 @@
 #pragma once
 #include "simpleguidx11.h"
 #include "structs.h"
+#include "aov.h"
+#include <future>
 
 class SimpleGuiDX11
 {
@@ -10,6 +12,39 @@ public:
 	
 	int MainLoop();	
 
+	/* renders one sample per pixel into the accumulation buffer, used by the producer thread or headless */
+	void RenderPass( const float t = 0.0f );
+
+	/* base seed of the per-row random streams, the same seed reproduces the same image */
+	void SetSeed( const unsigned int seed );
+
+	/* accumulated image, RGBA float per pixel */
+	const float * image() const;
+
+	/* writes the accumulated image as PFM or EXR, only safe on the producer thread between passes or headless */
+	int SaveImage( const std::string & file_name ) const;
+	/* thread safe request to save the accumulated image after the current pass */
+	void RequestSave( const std::string & file_name );
+	/* saves the image to file_name every interval seconds of rendering, 0 disables it */
+	void SetAutoSave( const std::string & file_name, const float interval );
+
+	/* Checkpoints hold the accumulated colors, per-pixel sample counts, the seed and the number of
+	finished passes, so a resumed render continues with the same random streams (see RenderPass).
+	Layout: CheckpointHeader, width * height * 4 floats, width * height ints. */
+	int SaveCheckpoint( const std::string & file_name ) const;
+	/* restores the checkpoint, only safe on the producer thread between passes or before rendering */
+	int LoadCheckpoint( const std::string & file_name );
+	/* thread safe request to resume from the checkpoint at the start of the next pass */
+	void RequestResume( const std::string & file_name );
+	/* writes a checkpoint every interval seconds in the background, 0 disables it */
+	void SetCheckpointInterval( const std::string & file_name, const float interval );
+
+	/* thread safe request to save all enabled AOVs after the current pass, name.ext gives name_aov.ext */
+	void RequestSaveAovs( const std::string & file_name );
+
+	int width() const;
+	int height() const;
+
 protected:
 	int Init();
 	int Cleanup();	
@@ -25,17 +60,65 @@ protected:
 
 	virtual int Ui();
 	virtual Color4f get_pixel( const int x, const int y, const float t = 0.0f );
+	/* called by the producer thread between passes, returning true restarts the accumulation */
+	virtual bool Update();
+	/* called by the producer thread right after each pass */
+	virtual void EndPass( const float pass_time );
+	/* post-processes the accumulated image, called by the producer thread after each pass, linear receives
+	the image for saving (linear radiance) and display the one shown on the screen, the default one
+	returns the accumulator itself for both */
+	virtual void Resolve( const float *& linear, const float *& display );
 
 	void Producer();
 
-	int width() const;
-	int height() const;
+	/* discards all accumulated samples, only safe on the producer thread between passes */
+	void ResetAccumulation();
 
 	bool vsync_{ true };
+	std::atomic<float> pass_time_{ 0.0f }; // duration of the last refinement pass (s)
+
+	float * accumulator_{ nullptr }; // running mean of all samples, RGBA per pixel, owned by the producer thread
+	int * sample_counts_{ nullptr }; // number of samples accumulated in each pixel
+	AovRegistry aovs_; // beauty, sample counts and the AOVs registered by the descendant
+	unsigned int seed_{ 1 };
+	int pass_{ 0 }; // number of finished passes
+
+	/* serves save requests and periodic saves of the resolved image, called by the producer thread after each pass */
+	void SaveOutputs( const float * image );
+
+	struct CheckpointHeader
+	{
+		char magic[4]; // PGCK
+		int version;
+		int width;
+		int height;
+		unsigned int seed;
+		int pass;
+	};
+
+	/* writes the checkpoint into a temporary file renamed to file_name at the end, so an interrupted
+	or short write keeps the previous checkpoint intact, returns 0 on success */
+	static int WriteCheckpoint( const std::string & file_name, const CheckpointHeader & header,
+		const float * colors, const int * counts, const size_t no_pixels );
+
+	std::mutex save_lock_; // guards the save requests and auto save settings
+	std::vector<std::string> save_requests_;
+	std::vector<std::string> aov_save_requests_;
+	std::string auto_save_file_{ "checkpoint.pfm" };
+	float auto_save_interval_{ 0.0f }; // (s)
+	std::chrono::high_resolution_clock::time_point last_auto_save_{ std::chrono::high_resolution_clock::now() };
+
+	std::string resume_request_; // empty if there is none
+	std::string checkpoint_file_{ "render.ckpt" };
+	float checkpoint_interval_{ 0.0f }; // (s)
+	std::chrono::high_resolution_clock::time_point last_checkpoint_{ std::chrono::high_resolution_clock::now() };
+	std::vector<float> checkpoint_colors_; // snapshot of the buffers being written by checkpoint_writer_
+	std::vector<int> checkpoint_counts_;
+	std::future<int> checkpoint_writer_; // pending asynchronous write, declared last so it is joined first
 
 private:	
 	WNDCLASSEX wc_;
-	HWND hwnd_;
+	HWND hwnd_{ nullptr };
 
 	ID3D11Device * g_pd3dDevice{ nullptr };
 	ID3D11DeviceContext * g_pd3dDeviceContext{ nullptr };
@@ -28,9 +28,73 @@ struct RTC_ALIGN( 16 ) Color4f
 
 struct Color3f { float r, g, b; };
 
+/* BVH build settings of the Embree scene, see rtcSetSceneBuildQuality, rtcSetSceneFlags and rtcSetGeometryBuildQuality */
+struct SceneProfile
+{
+	RTCBuildQuality scene_quality{ RTC_BUILD_QUALITY_MEDIUM }; // quality of the top-level BVH
+	RTCBuildQuality geometry_quality{ RTC_BUILD_QUALITY_MEDIUM }; // quality of the per-geometry BVHs
+	RTCSceneFlags flags{ RTC_SCENE_FLAG_NONE }; // combination of RTC_SCENE_FLAG_COMPACT, ROBUST and DYNAMIC
+	bool merge_surfaces{ false }; // loaded groups share one geometry with per-triangle materials, they cannot be edited then
+
+	/* high quality SAH build for final renders, slower to build but faster to trace */
+	static SceneProfile Final()
+	{
+		SceneProfile profile;
+		profile.scene_quality = RTC_BUILD_QUALITY_HIGH;
+		profile.geometry_quality = RTC_BUILD_QUALITY_HIGH;
+		profile.flags = RTC_SCENE_FLAG_ROBUST;
+		profile.merge_surfaces = true;
+		return profile;
+	}
+
+	/* fast low quality build for interactive previews */
+	static SceneProfile Preview()
+	{
+		SceneProfile profile;
+		profile.scene_quality = RTC_BUILD_QUALITY_LOW;
+		profile.geometry_quality = RTC_BUILD_QUALITY_LOW;
+		profile.flags = RTC_SCENE_FLAG_DYNAMIC;
+		return profile;
+	}
+
+	/* animated sequences, static surfaces get a good BVH once, moving ones are refitted and the top level is rebuilt per frame */
+	static SceneProfile Animation()
+	{
+		SceneProfile profile;
+		profile.scene_quality = RTC_BUILD_QUALITY_LOW;
+		profile.geometry_quality = RTC_BUILD_QUALITY_HIGH;
+		profile.flags = RTC_SCENE_FLAG_DYNAMIC;
+		return profile;
+	}
+};
+
+inline const char * BuildQualityToString( const RTCBuildQuality quality )
+{
+	switch ( quality )
+	{
+	case RTC_BUILD_QUALITY_LOW: return "low";
+	case RTC_BUILD_QUALITY_MEDIUM: return "medium";
+	case RTC_BUILD_QUALITY_HIGH: return "high";
+	case RTC_BUILD_QUALITY_REFIT: return "refit";
+	default: return "unknown";
+	}
+}
+
 struct RTCRayHitWithIor {
 	RTCRayHit ray_hit;
 	float ior = IOR_AIR;
+	float pdf = 0.0f; // solid angle pdf of the BSDF sample which generated the ray, 0 disables MIS on escape
+	bool light_sampled = false; // the vertex which generated the ray sampled the light tree, so emitters hit by it are already counted
+};
+
+/* first hit of a primary ray, it feeds the AOVs */
+struct PrimaryHit
+{
+	float distance{ FLT_MAX }; // FLT_MAX on a miss
+	Vector3 normal; // shading normal facing the ray, zero on a miss
+	Vector3 albedo; // diffuse reflectance, zero on a miss or if nobody asked for it
+	unsigned int material_id{ 0xffffffff }; // ID in the material table of the renderer
+	unsigned int geometry_id{ 0xffffffff }; // geomID of the hit in the top-level scene
 };
 
 inline void reorient_against(Normal3f & n, const float v_x, const float v_y, const float v_z) {
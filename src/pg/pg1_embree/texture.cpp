@@ -36,8 +36,39 @@ Texture::Texture( const char * file_name )
 			width_ = int( FreeImage_GetWidth( dib ) );
 			height_ = int( FreeImage_GetHeight( dib ) );
 
+			const FREE_IMAGE_TYPE type = FreeImage_GetImageType( dib );
+
+			if ( type == FIT_RGBF || type == FIT_RGBAF || type == FIT_FLOAT )
+			{
+				// HDR images stay in linear float, without the 8-bit conversion and sRGB decode
+				FIBITMAP * rgbf = ( type == FIT_RGBF ) ? dib : FreeImage_ConvertToRGBF( dib );
+
+				if ( rgbf && ( width_ != 0 ) && ( height_ != 0 ) )
+				{
+					float_data_ = new float[width_ * height_ * 3];
+
+					// FreeImage stores the bottom row first
+					for ( int y = 0; y < height_; ++y )
+					{
+						const FIRGBF * src = reinterpret_cast<const FIRGBF *>( FreeImage_GetScanLine( rgbf, height_ - 1 - y ) );
+						float * dst = &float_data_[y * width_ * 3];
+
+						for ( int x = 0; x < width_; ++x )
+						{
+							dst[x * 3] = src[x].red;
+							dst[x * 3 + 1] = src[x].green;
+							dst[x * 3 + 2] = src[x].blue;
+						}
+					}
+				}
+
+				if ( rgbf && rgbf != dib )
+				{
+					FreeImage_Unload( rgbf );
+				}
+			}
 			// if each of these is ok
-			if ( ( bits != 0 ) && ( width_ != 0 ) && ( height_ != 0 ) )
+			else if ( ( bits != 0 ) && ( width_ != 0 ) && ( height_ != 0 ) )
 			{				
 				// texture loaded
 				scan_width_ = FreeImage_GetPitch( dib ); // in bytes
@@ -47,6 +78,14 @@ Texture::Texture( const char * file_name )
 				FreeImage_ConvertToRawBits( data_, dib, scan_width_, pixel_size_ * 8, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, TRUE );
 			}
 
+			// nothing was converted, the texture stays empty like one which failed to load
+			if ( ( data_ == nullptr ) && ( float_data_ == nullptr ) )
+			{
+				printf( "Unable to convert texture '%s'.\n", file_name );
+				width_ = 0;
+				height_ = 0;
+			}
+
 			FreeImage_Unload( dib );
 			bits = nullptr;
 		}
@@ -64,6 +103,15 @@ Texture::~Texture()
 		width_ = 0;
 		height_ = 0;
 	}
+
+	if ( float_data_ )
+	{
+		delete[] float_data_;
+		float_data_ = nullptr;
+
+		width_ = 0;
+		height_ = 0;
+	}
 }
 
 Color4f Texture::get_texel( const float u, const float v ) const
@@ -98,6 +146,32 @@ Color4f Texture::get_texel( const float u, const float v ) const
 	const int x1 = min(width_ - 1, x0 + 1);
 	const int y1 = min(height_ - 1, y0 + 1);
 
+	if (float_data_ != nullptr)
+	{
+		// already linear, no decode needed
+		const float * q1 = &float_data_[(y0 * width_ + x0) * 3];
+		const float * q2 = &float_data_[(y0 * width_ + x1) * 3];
+		const float * q3 = &float_data_[(y1 * width_ + x1) * 3];
+		const float * q4 = &float_data_[(y1 * width_ + x0) * 3];
+
+		const float kx = x - x0;
+		const float ky = y - y0;
+		const float w1 = (1 - kx) * (1 - ky);
+		const float w2 = kx * (1 - ky);
+		const float w3 = kx * ky;
+		const float w4 = (1 - kx) * ky;
+
+		return Color4f(q1[0] * w1 + q2[0] * w2 + q3[0] * w3 + q4[0] * w4,
+			q1[1] * w1 + q2[1] * w2 + q3[1] * w3 + q4[1] * w4,
+			q1[2] * w1 + q2[2] * w2 + q3[2] * w3 + q4[2] * w4, 1);
+	}
+
+	if (data_ == nullptr)
+	{
+		// empty texture
+		return Color4f(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
 	unsigned char * p1 = &data_[x0 * pixel_size_ + y0 * scan_width_];
 	unsigned char * p2 = &data_[x1 * pixel_size_ + y0 * scan_width_];
 	unsigned char * p3 = &data_[x1 * pixel_size_ + y1 * scan_width_];
@@ -124,3 +198,8 @@ int Texture::height() const
 {
 	return height_;
 }
+
+bool Texture::is_hdr() const
+{
+	return float_data_ != nullptr;
+}
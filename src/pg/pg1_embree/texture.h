@@ -22,12 +22,16 @@ public:
 	int width() const;
 	int height() const;
 
+	/* true for floating point images (e.g. Radiance HDR, OpenEXR, PFM) kept in linear float */
+	bool is_hdr() const;
+
 private:	
 	int width_{ 0 }; // image width (px)
 	int height_{ 0 }; // image height (px)
 	int scan_width_{ 0 }; // size of image row (bytes)
 	int pixel_size_{ 0 }; // size of each pixel (bytes)
 	BYTE * data_{ nullptr }; // image data in BGR format
+	float * float_data_{ nullptr }; // linear RGB data of HDR images, data_ is not used then
 };
 
 #endif
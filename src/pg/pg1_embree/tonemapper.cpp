@@ -0,0 +1,51 @@
+#include "stdafx.h"
+#include "tonemapper.h"
+#include "structs.h"
+#include "utils.h"
+
+namespace
+{
+	inline float Reinhard( const float x )
+	{
+		return x / ( 1.0f + x );
+	}
+
+	/* ACES filmic curve fitted by K. Narkowicz */
+	inline float ACES( const float x )
+	{
+		return max( 0.0f, min( 1.0f, ( x * ( 2.51f * x + 0.03f ) ) / ( x * ( 2.43f * x + 0.59f ) + 0.14f ) ) );
+	}
+}
+
+Tonemapper::Tonemapper()
+{
+	for ( int i = 0; i <= LUT_SIZE; ++i )
+	{
+		srgb_lut_[i] = getSRGBColorValueForComponent( static_cast<float>( i ) / LUT_SIZE );
+	}
+}
+
+void Tonemapper::Apply( const float * input, float * output, const int no_pixels, const TonemapSettings & settings ) const
+{
+	const float scale = powf( 2.0f, settings.exposure );
+	const int tonemap = settings.tonemap;
+	const bool srgb = settings.srgb;
+
+#pragma omp parallel for schedule(static)
+	for ( int i = 0; i < no_pixels; ++i )
+	{
+		for ( int c = 0; c < 3; ++c )
+		{
+			float value = max( 0.0f, input[i * 4 + c] * scale );
+
+			switch ( tonemap )
+			{
+			case TONEMAP_REINHARD: value = Reinhard( value ); break;
+			case TONEMAP_ACES: value = ACES( value ); break;
+			}
+
+			output[i * 4 + c] = ( srgb ) ? EncodeSRGB( value ) : value;
+		}
+		output[i * 4 + 3] = input[i * 4 + 3];
+	}
+}
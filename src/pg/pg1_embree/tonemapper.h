@@ -0,0 +1,59 @@
+#ifndef TONEMAPPER_H_
+#define TONEMAPPER_H_
+
+/* curve compressing the exposed radiance into the displayable range */
+enum TonemapOperator { TONEMAP_NONE = 0, TONEMAP_REINHARD = 1, TONEMAP_ACES = 2 };
+
+struct TonemapSettings
+{
+	float exposure{ 0.0f }; // (EV), the radiance is scaled by 2^exposure
+	int tonemap{ TONEMAP_NONE }; // TonemapOperator
+	bool srgb{ true }; // encode with the sRGB transfer function, otherwise the output stays linear
+};
+
+/*! \class Tonemapper
+\brief Resolve pass turning the linear accumulated radiance into display values.
+
+The integrator works in linear radiance only, the exposure, the tonemapping curve and
+the sRGB encoding are applied here once per displayed pixel instead of per ray. The sRGB
+transfer function is read from a table with linear interpolation, which avoids the pow
+call and stays within 2e-5 of the exact curve (well below one 8-bit step).
+*/
+class Tonemapper
+{
+public:
+	Tonemapper();
+
+	/*! \fn void Apply( const float * input, float * output, const int no_pixels, const TonemapSettings & settings ) const
+	\brief Maps RGBA pixels, alpha is copied, input and output may be the same buffer.
+	*/
+	void Apply( const float * input, float * output, const int no_pixels, const TonemapSettings & settings ) const;
+
+	/* sRGB encoded value of the linear component, exact (and slow) outside of <0, 1> */
+	inline float EncodeSRGB( const float linear ) const;
+
+private:
+	static const int LUT_SIZE = 4096;
+
+	float srgb_lut_[LUT_SIZE + 1]; // encoded values of i / LUT_SIZE
+};
+
+inline float Tonemapper::EncodeSRGB( const float linear ) const
+{
+	if ( !( linear > 0.0f ) )
+	{
+		return 0.0f;
+	}
+
+	if ( linear >= 1.0f )
+	{
+		return ( linear == 1.0f ) ? 1.0f : 1.055f * powf( linear, 1.0f / 2.4f ) - 0.055f;
+	}
+
+	const float x = linear * LUT_SIZE;
+	const int i = static_cast<int>( x );
+
+	return srgb_lut_[i] + ( srgb_lut_[i + 1] - srgb_lut_[i] ) * ( x - i );
+}
+
+#endif
@@ -208,7 +208,7 @@ int ship_model(const std::string file_name, const char * config)
 
 	//Ship Model
 	Raytracer raytracer(640, 480, deg2rad(50.0),
-		Vector3(175, -140, 130), Vector3(0, 0, 35), config);
+		Vector3(175, -140, 130), Vector3(0, 0, 35), config, SceneProfile::Preview());
 
 	raytracer.LoadScene(file_name);
 	raytracer.MainLoop();
@@ -221,7 +221,7 @@ int path_tracer(const std::string file_name, const char * config)
 
 	//Ship Model
 	Raytracer raytracer(640, 480, deg2rad(40.0),
-		Vector3(40, -940, 250), Vector3(0, 0, 250), config);
+		Vector3(40, -940, 250), Vector3(0, 0, 250), config, SceneProfile::Final());
 
 	raytracer.LoadScene(file_name);
 	raytracer.MainLoop();
@@ -229,6 +229,25 @@ int path_tracer(const std::string file_name, const char * config)
 	return EXIT_SUCCESS;
 }
 
+int path_tracer_sequence(const std::string file_name, const std::string output_pattern, const char * config)
+{
+	//Fly-through the Cornell box
+	Raytracer raytracer(640, 480, deg2rad(40.0),
+		Vector3(40, -940, 250), Vector3(0, 0, 250), config, SceneProfile::Animation());
+
+	raytracer.LoadScene(file_name);
+
+	Sequence sequence;
+	sequence.camera.push_back(CameraKey{ 0.0f, Vector3(40, -940, 250), Vector3(0, 0, 250) });
+	sequence.camera.push_back(CameraKey{ 2.0f, Vector3(-150, -700, 300), Vector3(0, 0, 200) });
+	sequence.camera.push_back(CameraKey{ 4.0f, Vector3(0, -450, 250), Vector3(0, 0, 250) });
+	sequence.last_frame = 96;
+	sequence.spp = 32;
+	sequence.output_pattern = output_pattern;
+
+	return (raytracer.RenderSequence(sequence) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int geosphere(const std::string file_name, const char * config)
 {
 
@@ -242,6 +261,18 @@ int geosphere(const std::string file_name, const char * config)
 	return EXIT_SUCCESS;
 }
 
+int instanced_scene(const std::string file_name, const char * config)
+{
+	//Instanced Geospheres
+	Raytracer raytracer(640, 480, deg2rad(45.0),
+		Vector3(12, -12, 8), Vector3(0, 0, 0), config);
+
+	raytracer.LoadSceneDescription(file_name);
+	raytracer.MainLoop();
+
+	return EXIT_SUCCESS;
+}
+
 /* OptiX error reporting function */
 void error_handler(RTresult code)
 {
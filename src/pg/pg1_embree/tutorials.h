@@ -8,7 +8,10 @@ int tutorial_2();
 int tutorial_3( const std::string file_name, const char * config = "threads=0,verbose=0" );
 int ship_model(const std::string file_name, const char * config = "threads=0,verbose=0");
 int path_tracer(const std::string file_name, const char * config = "threads=0,verbose=0");
+/* headless fly-through rendered into output_pattern (printf pattern of the frame number) */
+int path_tracer_sequence(const std::string file_name, const std::string output_pattern = "frame_%04d.exr", const char * config = "threads=0,verbose=0");
 int geosphere(const std::string file_name, const char * config = "threads=0,verbose=0");
+int instanced_scene(const std::string file_name, const char * config = "threads=0,verbose=0");
 int tutorial_7();
 
 #endif
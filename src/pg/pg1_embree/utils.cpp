@@ -8,7 +8,9 @@ using std::uniform_real_distribution;
 typedef mt19937                                     Engine;
 typedef uniform_real_distribution<float>            Distribution;
 
-auto uniform_generator = std::bind(Distribution(0.0f, 1.0f), Engine(1));
+// every thread draws from its own engine, see SeedRandom
+thread_local Engine engine(1);
+thread_local Distribution distribution(0.0f, 1.0f);
 
 
 float Random(const float range_min, const float range_max)
@@ -18,7 +20,7 @@ float Random(const float range_min, const float range_max)
 	//#pragma omp critical ( random ) 
 	{
 		//ksi = static_cast<float>( rand() ) / ( RAND_MAX + 1 );		
-		ksi = static_cast<float>(uniform_generator());
+		ksi = static_cast<float>(distribution(engine));
 
 		/*static float randoms[] = { 0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f, 0.9f };
 		static int next = 0;
@@ -31,6 +33,25 @@ float Random(const float range_min, const float range_max)
 	return ksi * (range_max - range_min) + range_min;
 }
 
+void SeedRandom(const unsigned int seed)
+{
+	engine.seed(seed);
+	distribution.reset();
+}
+
+unsigned int HashSeed(const unsigned int seed, const unsigned int index)
+{
+	// murmur3 finalizer
+	unsigned int h = seed ^ (index * 0x9e3779b9u);
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+
+	return h;
+}
+
 long long GetFileSize64(const char * file_name)
 {
 	FILE * file = fopen(file_name, "rb");
@@ -224,13 +245,14 @@ RTCHit createEmptyHit() {
 	RTCHit hit;
 	hit.geomID = RTC_INVALID_GEOMETRY_ID;
 	hit.primID = RTC_INVALID_GEOMETRY_ID;
+	hit.instID[0] = RTC_INVALID_GEOMETRY_ID; // Embree sets it only when an instance is hit
 	hit.Ng_x = 0.0f; // geometry normal
 	hit.Ng_y = 0.0f;
 	hit.Ng_z = 0.0f;
 	return hit;
 }
 
-RTCRay createRay(Vector3 origin, Vector3 dir, float tfar, float tnear) {
+RTCRay createRay(Vector3 origin, Vector3 dir, float tfar, float tnear, float time) {
 	RTCRay ray;
 
 	ray.tnear = tnear; // start of ray segment
@@ -242,7 +264,7 @@ RTCRay createRay(Vector3 origin, Vector3 dir, float tfar, float tnear) {
 	ray.dir_x = dir.x; // ray direction
 	ray.dir_y = dir.y;
 	ray.dir_z = dir.z;
-	ray.time = 0.0f; // time of this ray for motion blur
+	ray.time = time; // time of this ray for motion blur
 	ray.tfar = tfar; // end of ray segment (set to hit distance)
 
 	ray.mask = 0; // can be used to mask out some geometries for some rays
@@ -251,9 +273,9 @@ RTCRay createRay(Vector3 origin, Vector3 dir, float tfar, float tnear) {
 	return ray;
 }
 
-RTCRayHitWithIor createRayWithEmptyHitAndIor(Vector3 origin, Vector3 dir, float tfar, float tnear, float ior) {
+RTCRayHitWithIor createRayWithEmptyHitAndIor(Vector3 origin, Vector3 dir, float tfar, float tnear, float ior, float time) {
 	RTCRayHitWithIor myRtcRay;
-	myRtcRay.ray_hit.ray = createRay(origin, dir, tfar, tnear);
+	myRtcRay.ray_hit.ray = createRay(origin, dir, tfar, tnear, time);
 	myRtcRay.ray_hit.hit = createEmptyHit();
 	myRtcRay.ior = ior;
 	return myRtcRay;
@@ -63,6 +63,20 @@ namespace utils
 */
 float Random( const float range_min = 0.0f, const float range_max = 1.0f );
 
+/*! \fn void SeedRandom( const unsigned int seed )
+\brief Inicializuje genertor pseudonhodnch sel volajcho vlkna.
+\param seed Semnko genertoru.
+*/
+void SeedRandom( const unsigned int seed );
+
+/*! \fn unsigned int HashSeed( const unsigned int seed, const unsigned int index )
+\brief Odvod ze semnka a indexu (nap. dku obrazu) semnko nezvisl posloupnosti.
+\param seed Vchoz semnko.
+\param index Index posloupnosti.
+\return Nov semnko.
+*/
+unsigned int HashSeed( const unsigned int seed, const unsigned int index );
+
 /*! \fn long long GetFileSize64( const char * file_name )
 \brief Vrt velikost souboru v bytech.
 \param file_name pln cesta k souboru
@@ -107,9 +121,9 @@ float getSRGBColorValueForComponent(float colorComponent);
 float changeGamma(float value, float coef = 1);
 Color4f changeGamma(Color4f value, float coef = 1);
 RTCHit createEmptyHit();
-RTCRay createRay(Vector3 origin, Vector3 dir, float tfar = FLT_MAX, float tnear = FLT_MIN);
+RTCRay createRay(Vector3 origin, Vector3 dir, float tfar = FLT_MAX, float tnear = FLT_MIN, float time = 0.0f);
 
-RTCRayHitWithIor createRayWithEmptyHitAndIor(Vector3 origin, Vector3 dir, float tfar, float tnear, float ior);
+RTCRayHitWithIor createRayWithEmptyHitAndIor(Vector3 origin, Vector3 dir, float tfar, float tnear, float ior, float time = 0.0f);
 
 
 #endif